@@ -0,0 +1,1088 @@
+/* drivers/rtc/rtc-hym8563-emu.c - HYM8563 register model on a software i2c bus
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * Registers an i2c adapter with a HYM8563 at 0x51 behind it, so that
+ * rtc-hym8563 binds to the model as it would to the chip. The model
+ * counts virtual time in 32768 Hz cycles. It follows CLOCK_MONOTONIC and
+ * can be pushed ahead from debugfs, and covers:
+ *
+ *  - the calendar, with VL, and the seconds divider restarting when the
+ *    time registers are written
+ *  - the minute alarm, compared each time the calendar enters a minute
+ *  - the countdown timer on the 4096, 64, 1 and 1/60 Hz grids with
+ *    reload, TF and the TI pulse mode
+ *  - AF/TF/AIE/TIE driving INT, raised on a private interrupt number
+ *    that is handed to the driver as the board irq
+ *  - CLKOUT, which only holds its setting
+ *
+ * debugfs hym8563-emu/:
+ *  xfers	transfers, read and write messages and bytes on the wire;
+ *		writing anything resets them
+ *  advance	write a number of ns to move virtual time ahead, at most
+ *		HYM8563_EMU_ADVANCE_MAX_S at once
+ *  regs	the register file as the chip would return it
+ *
+ * With selftest=1 loading the module runs the driver against the model,
+ * and the load fails with -EINVAL, the model torn down, if an operation
+ * costs other than the expected number of transfers. KUnit only came
+ * with 5.5, so on the 4.3-4.7 kernels the driver targets the checks run
+ * at module load instead. The driver must be loaded first and use its
+ * default parameters.
+ */
+
+#define pr_fmt(fmt) "hym8563-emu: " fmt
+
+#include <linux/module.h>
+#include <linux/i2c.h>
+#include <linux/bcd.h>
+#include <linux/rtc.h>
+#include <linux/delay.h>
+#include <linux/slab.h>
+#include <linux/irq.h>
+#include <linux/irq_work.h>
+#include <linux/interrupt.h>
+#include <linux/hrtimer.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/uaccess.h>
+#include <linux/clk.h>
+#include <linux/workqueue.h>
+#include "rtc-HYM8563.h"
+
+#define HYM8563_EMU_ADDR		0x51
+#define HYM8563_EMU_HZ			32768
+#define HYM8563_EMU_ADVANCE_MAX_S	(31 * 24 * 3600)
+/* TI pulses delivered per catch-up, a 4096 Hz timer cannot starve us */
+#define HYM8563_EMU_PULSES_MAX		4096
+
+#define HYM8563_CTL1_STOP		BIT(5)
+
+static unsigned int byte_ns;
+module_param(byte_ns, uint, 0644);
+MODULE_PARM_DESC(byte_ns, "bus time per byte, address bytes included (90000 is about 100 kHz, 22500 about 400 kHz)");
+
+static bool vl = true;
+module_param(vl, bool, 0444);
+MODULE_PARM_DESC(vl, "start with VL set, as after the backup supply ran out");
+
+static bool selftest;
+module_param(selftest, bool, 0444);
+MODULE_PARM_DESC(selftest, "check the driver's transfers per operation against the model on load");
+
+/* exported by rtc-hym8563.c */
+int xh_rtc_add_alarm_idx(int index, unsigned long sec);
+int xh_rtc_del_alarm_idx(int index, int id);
+
+struct hym8563_emu {
+	struct i2c_adapter	adap;
+	struct i2c_client	*client;
+
+	/* model state, also taken from the hrtimer */
+	spinlock_t		lock;
+	u8			regs[HYM8563_REG_LEN];
+	u8			ptr;		/* register auto-increment */
+	u8			t_reload;	/* last value written to T_COUNT */
+	u64			cycle;		/* virtual time the model is at */
+	u64			sec_base;	/* cycle the seconds divider started */
+	u64			offset;		/* cycles added through advance */
+	ktime_t			epoch;		/* CLOCK_MONOTONIC at cycle 0 */
+	bool			line;		/* INT asserted by AF/TF */
+	unsigned int		pulses;		/* INT edges not raised yet */
+	bool			dying;
+	struct hrtimer		timer;
+
+	/* INT, raised from irq_work so handlers run in hard irq context */
+	int			irq;
+	struct irq_work		irq_work;
+	atomic_t		irq_pending;
+
+	unsigned long		xfers;
+	unsigned long		reads;
+	unsigned long		writes;
+	unsigned long		bytes;
+
+	struct dentry		*debugfs;
+};
+
+static struct hym8563_emu *hym8563_emu;
+
+/* bits that hold a value, the others read as 0 */
+static const u8 hym8563_emu_masks[HYM8563_REG_LEN] = {
+	[RTC_CTL1]	= 0xa8,
+	[RTC_CTL2]	= 0x1f,
+	[RTC_SEC]	= 0xff,
+	[RTC_MIN]	= 0x7f,
+	[RTC_HOUR]	= 0x3f,
+	[RTC_DAY]	= 0x3f,
+	[RTC_WEEK]	= 0x07,
+	[RTC_MON]	= 0x9f,
+	[RTC_YEAR]	= 0xff,
+	[RTC_A_MIN]	= 0xff,
+	[RTC_A_HOUR]	= 0xbf,
+	[RTC_A_DAY]	= 0xbf,
+	[RTC_A_WEEK]	= 0x87,
+	[RTC_CLKOUT]	= 0x83,
+	[RTC_T_CTL]	= 0x83,
+	[RTC_T_COUNT]	= 0xff,
+};
+
+/* countdown source periods in cycles, by TD */
+static const u64 hym8563_emu_periods[4] = {
+	HYM8563_EMU_HZ / 4096,
+	HYM8563_EMU_HZ / 64,
+	HYM8563_EMU_HZ,
+	60 * HYM8563_EMU_HZ,
+};
+
+static u64 hym8563_emu_ns_to_cycles(u64 ns)
+{
+	u32 rem;
+	u64 sec = div_u64_rem(ns, NSEC_PER_SEC, &rem);
+
+	return sec * HYM8563_EMU_HZ + div_u64((u64)rem * HYM8563_EMU_HZ,
+					      NSEC_PER_SEC);
+}
+
+/* rounded up, so the cycle has been reached at the returned time */
+static u64 hym8563_emu_cycles_to_ns(u64 cycles)
+{
+	u64 sec = div_u64(cycles, HYM8563_EMU_HZ);
+	u64 rem = cycles - sec * HYM8563_EMU_HZ;
+
+	return sec * NSEC_PER_SEC +
+	       div_u64(rem * NSEC_PER_SEC + HYM8563_EMU_HZ - 1, HYM8563_EMU_HZ);
+}
+
+static u64 hym8563_emu_now(struct hym8563_emu *emu)
+{
+	return hym8563_emu_ns_to_cycles(ktime_to_ns(ktime_sub(ktime_get(),
+							      emu->epoch))) +
+	       emu->offset;
+}
+
+static ktime_t hym8563_emu_cycle_time(struct hym8563_emu *emu, u64 cycle)
+{
+	return ktime_add_ns(emu->epoch,
+			    hym8563_emu_cycles_to_ns(cycle - emu->offset));
+}
+
+/* edges of a source with @period in (@from, @to], on the divider's grid */
+static u64 hym8563_emu_ticks(struct hym8563_emu *emu, u64 from, u64 to,
+			     u64 period)
+{
+	return div64_u64(to - emu->sec_base, period) -
+	       div64_u64(from - emu->sec_base, period);
+}
+
+static unsigned long hym8563_emu_time(struct hym8563_emu *emu)
+{
+	const u8 *regs = emu->regs;
+	struct rtc_time tm = {
+		.tm_sec = bcd2bin(regs[RTC_SEC] & 0x7f),
+		.tm_min = bcd2bin(regs[RTC_MIN]),
+		.tm_hour = bcd2bin(regs[RTC_HOUR]),
+		.tm_mday = bcd2bin(regs[RTC_DAY]),
+		.tm_mon = bcd2bin(regs[RTC_MON] & 0x1f) - 1,
+		.tm_year = bcd2bin(regs[RTC_YEAR]) +
+			   (regs[RTC_MON] & CENTURY ? 0 : 100),
+	};
+	unsigned long sec;
+
+	rtc_tm_to_time(&tm, &sec);
+	return sec;
+}
+
+/* the weekday counts on its own, it is not derived from the date */
+static void hym8563_emu_store_time(struct hym8563_emu *emu, unsigned long sec,
+				   unsigned int days)
+{
+	u8 *regs = emu->regs;
+	struct rtc_time tm;
+
+	rtc_time_to_tm(sec, &tm);
+	regs[RTC_SEC] = (regs[RTC_SEC] & VL) | bin2bcd(tm.tm_sec);
+	regs[RTC_MIN] = bin2bcd(tm.tm_min);
+	regs[RTC_HOUR] = bin2bcd(tm.tm_hour);
+	regs[RTC_DAY] = bin2bcd(tm.tm_mday);
+	regs[RTC_WEEK] = (regs[RTC_WEEK] + days) % 7;
+	regs[RTC_MON] = (tm.tm_year < 100 ? CENTURY : 0) | bin2bcd(tm.tm_mon + 1);
+	regs[RTC_YEAR] = bin2bcd(tm.tm_year % 100);
+}
+
+/* AE (bit 7) set leaves a field out, all four left out never match */
+static bool hym8563_emu_alarm_match(struct hym8563_emu *emu,
+				    const struct rtc_time *tm, unsigned int wday)
+{
+	const u8 *regs = emu->regs;
+	bool any = false;
+
+	if (!(regs[RTC_A_MIN] & 0x80)) {
+		if (bcd2bin(regs[RTC_A_MIN] & 0x7f) != tm->tm_min)
+			return false;
+		any = true;
+	}
+	if (!(regs[RTC_A_HOUR] & 0x80)) {
+		if (bcd2bin(regs[RTC_A_HOUR] & 0x3f) != tm->tm_hour)
+			return false;
+		any = true;
+	}
+	if (!(regs[RTC_A_DAY] & 0x80)) {
+		if (bcd2bin(regs[RTC_A_DAY] & 0x3f) != tm->tm_mday)
+			return false;
+		any = true;
+	}
+	if (!(regs[RTC_A_WEEK] & 0x80)) {
+		if ((regs[RTC_A_WEEK] & 0x07) != wday)
+			return false;
+		any = true;
+	}
+	return any;
+}
+
+static void hym8563_emu_count_seconds(struct hym8563_emu *emu, u64 secs)
+{
+	unsigned long t = hym8563_emu_time(emu), m;
+	struct rtc_time tm;
+	unsigned int wday;
+
+	/* AF stays set until cleared, later matches change nothing */
+	if (!(emu->regs[RTC_CTL2] & AF)) {
+		for (m = roundup(t + 1, 60); m <= t + secs; m += 60) {
+			rtc_time_to_tm(m, &tm);
+			wday = (emu->regs[RTC_WEEK] + m / 86400 - t / 86400) % 7;
+			if (hym8563_emu_alarm_match(emu, &tm, wday)) {
+				emu->regs[RTC_CTL2] |= AF;
+				break;
+			}
+		}
+	}
+	hym8563_emu_store_time(emu, t + secs, (t + secs) / 86400 - t / 86400);
+}
+
+static void hym8563_emu_count_timer(struct hym8563_emu *emu, u64 from, u64 to)
+{
+	u8 *regs = emu->regs;
+	u64 ticks, fires, left;
+	u8 reload = emu->t_reload;
+
+	if (!(regs[RTC_T_CTL] & TE) || !regs[RTC_T_COUNT])
+		return;
+
+	ticks = hym8563_emu_ticks(emu, from, to,
+				  hym8563_emu_periods[regs[RTC_T_CTL] & 3]);
+	if (ticks < regs[RTC_T_COUNT]) {
+		regs[RTC_T_COUNT] -= ticks;
+		return;
+	}
+
+	/* reaching zero sets TF and reloads, a reload of 0 stays there */
+	left = ticks - regs[RTC_T_COUNT];
+	fires = 1;
+	if (reload) {
+		fires += div_u64(left, reload);
+		regs[RTC_T_COUNT] = reload - (left - div_u64(left, reload) * reload);
+	} else {
+		regs[RTC_T_COUNT] = 0;
+	}
+	regs[RTC_CTL2] |= TF;
+	if ((regs[RTC_CTL2] & (TI | TIE)) == (TI | TIE))
+		emu->pulses = min_t(u64, emu->pulses + fires,
+				    HYM8563_EMU_PULSES_MAX);
+}
+
+/* bring the model up to @now, lock held */
+static void hym8563_emu_sync(struct hym8563_emu *emu, u64 now)
+{
+	u64 old = emu->cycle;
+	u64 secs;
+
+	if (now <= old)
+		return;
+	emu->cycle = now;
+
+	/* STOP holds the divider, and with it the calendar and the timer */
+	if (emu->regs[RTC_CTL1] & HYM8563_CTL1_STOP) {
+		emu->sec_base += now - old;
+		return;
+	}
+
+	hym8563_emu_count_timer(emu, old, now);
+	secs = hym8563_emu_ticks(emu, old, now, HYM8563_EMU_HZ);
+	if (secs)
+		hym8563_emu_count_seconds(emu, secs);
+}
+
+/* the next cycle something can change INT at, 0 if nothing can */
+static u64 hym8563_emu_next_event(struct hym8563_emu *emu)
+{
+	const u8 *regs = emu->regs;
+	u64 next = 0, period, edge, t;
+	unsigned long sec;
+
+	if (regs[RTC_CTL1] & HYM8563_CTL1_STOP)
+		return 0;
+
+	if ((regs[RTC_T_CTL] & TE) && regs[RTC_T_COUNT] &&
+	    (regs[RTC_CTL2] & TIE)) {
+		period = hym8563_emu_periods[regs[RTC_T_CTL] & 3];
+		edge = div64_u64(emu->cycle - emu->sec_base, period);
+		next = emu->sec_base + (edge + regs[RTC_T_COUNT]) * period;
+	}
+
+	if ((regs[RTC_CTL2] & (AIE | AF)) == AIE) {
+		sec = hym8563_emu_time(emu);
+		edge = div_u64(emu->cycle - emu->sec_base, HYM8563_EMU_HZ);
+		t = emu->sec_base +
+		    (edge + roundup(sec + 1, 60) - sec) * HYM8563_EMU_HZ;
+		if (!next || t < next)
+			next = t;
+	}
+	return next;
+}
+
+/*
+ * Called after every change, lock held: takes the INT edges due and
+ * sets the timer for the next one. Returns how many to raise.
+ */
+static unsigned int hym8563_emu_update(struct hym8563_emu *emu)
+{
+	u8 ctl2 = emu->regs[RTC_CTL2];
+	unsigned int raise = emu->pulses;
+	bool level;
+	u64 next;
+
+	/* in pulse mode TF does not hold INT low */
+	level = ((ctl2 & AF) && (ctl2 & AIE)) ||
+		((ctl2 & TF) && (ctl2 & TIE) && !(ctl2 & TI));
+	if (level && !emu->line)
+		raise++;
+	emu->line = level;
+	emu->pulses = 0;
+
+	next = emu->dying ? 0 : hym8563_emu_next_event(emu);
+	if (next)
+		hrtimer_start(&emu->timer, hym8563_emu_cycle_time(emu, next),
+			      HRTIMER_MODE_ABS);
+	else
+		hrtimer_try_to_cancel(&emu->timer);
+	return raise;
+}
+
+static void hym8563_emu_raise(struct hym8563_emu *emu, unsigned int n)
+{
+	if (!n || emu->irq <= 0)
+		return;
+	atomic_add(n, &emu->irq_pending);
+	irq_work_queue(&emu->irq_work);
+}
+
+static void hym8563_emu_irq_work(struct irq_work *work)
+{
+	struct hym8563_emu *emu = container_of(work, struct hym8563_emu,
+					       irq_work);
+	int n = atomic_xchg(&emu->irq_pending, 0);
+
+	while (n-- > 0)
+		generic_handle_irq(emu->irq);
+}
+
+static enum hrtimer_restart hym8563_emu_timer(struct hrtimer *timer)
+{
+	struct hym8563_emu *emu = container_of(timer, struct hym8563_emu, timer);
+	unsigned long flags;
+	unsigned int raise;
+
+	spin_lock_irqsave(&emu->lock, flags);
+	hym8563_emu_sync(emu, hym8563_emu_now(emu));
+	raise = hym8563_emu_update(emu);
+	spin_unlock_irqrestore(&emu->lock, flags);
+
+	hym8563_emu_raise(emu, raise);
+	return HRTIMER_NORESTART;
+}
+
+/* one byte of a write message, lock held */
+static void hym8563_emu_write_reg(struct hym8563_emu *emu, u8 reg, u8 val,
+				  bool *time_written)
+{
+	u8 *regs = emu->regs;
+	u8 old = regs[reg];
+
+	val &= hym8563_emu_masks[reg];
+	switch (reg) {
+	case RTC_CTL1:
+		/* leaving STOP restarts the divider */
+		if ((old & HYM8563_CTL1_STOP) && !(val & HYM8563_CTL1_STOP))
+			*time_written = true;
+		break;
+	case RTC_CTL2:
+		/* writing 1 to AF/TF keeps them, 0 clears */
+		val = (val & ~(AF | TF)) | (old & val & (AF | TF));
+		break;
+	case RTC_SEC ... RTC_YEAR:
+		*time_written = true;
+		break;
+	case RTC_T_COUNT:
+		emu->t_reload = val;
+		break;
+	}
+	regs[reg] = val;
+}
+
+static int hym8563_emu_xfer(struct i2c_adapter *adap, struct i2c_msg *msgs,
+			    int num)
+{
+	struct hym8563_emu *emu = i2c_get_adapdata(adap);
+	unsigned long flags, bytes = 0;
+	unsigned int raise, delay;
+	bool time_written;
+	int i, j;
+
+	for (i = 0; i < num; i++)
+		if (msgs[i].addr != HYM8563_EMU_ADDR)
+			return -ENXIO;
+
+	spin_lock_irqsave(&emu->lock, flags);
+	/* the chip latches the time when the transfer starts */
+	hym8563_emu_sync(emu, hym8563_emu_now(emu));
+	for (i = 0; i < num; i++) {
+		struct i2c_msg *msg = &msgs[i];
+
+		bytes += 1 + msg->len;
+		if (msg->flags & I2C_M_RD) {
+			for (j = 0; j < msg->len; j++) {
+				msg->buf[j] = emu->regs[emu->ptr];
+				emu->ptr = (emu->ptr + 1) % HYM8563_REG_LEN;
+			}
+			emu->reads++;
+			continue;
+		}
+
+		emu->writes++;
+		if (!msg->len)
+			continue;
+		time_written = false;
+		emu->ptr = msg->buf[0] % HYM8563_REG_LEN;
+		for (j = 1; j < msg->len; j++) {
+			hym8563_emu_write_reg(emu, emu->ptr, msg->buf[j],
+					      &time_written);
+			emu->ptr = (emu->ptr + 1) % HYM8563_REG_LEN;
+		}
+		if (time_written)
+			emu->sec_base = emu->cycle;
+	}
+	emu->xfers++;
+	emu->bytes += bytes;
+	raise = hym8563_emu_update(emu);
+	spin_unlock_irqrestore(&emu->lock, flags);
+
+	hym8563_emu_raise(emu, raise);
+
+	delay = ACCESS_ONCE(byte_ns);
+	if (delay) {
+		u64 ns = (u64)delay * bytes;
+
+		if (ns < 10 * NSEC_PER_USEC)
+			ndelay(ns);
+		else
+			usleep_range(div_u64(ns, NSEC_PER_USEC),
+				     div_u64(ns, NSEC_PER_USEC) + 1);
+	}
+	return num;
+}
+
+static u32 hym8563_emu_func(struct i2c_adapter *adap)
+{
+	return I2C_FUNC_I2C | I2C_FUNC_SMBUS_EMUL;
+}
+
+static const struct i2c_algorithm hym8563_emu_algo = {
+	.master_xfer	= hym8563_emu_xfer,
+	.functionality	= hym8563_emu_func,
+};
+
+/* move virtual time ahead by @ns and deliver whatever fired meanwhile */
+static void hym8563_emu_advance(struct hym8563_emu *emu, u64 ns)
+{
+	unsigned long flags;
+	unsigned int raise;
+
+	spin_lock_irqsave(&emu->lock, flags);
+	emu->offset += hym8563_emu_ns_to_cycles(ns);
+	hym8563_emu_sync(emu, hym8563_emu_now(emu));
+	raise = hym8563_emu_update(emu);
+	spin_unlock_irqrestore(&emu->lock, flags);
+
+	hym8563_emu_raise(emu, raise);
+}
+
+static void hym8563_emu_read_regs(struct hym8563_emu *emu, u8 *regs)
+{
+	unsigned long flags;
+	unsigned int raise;
+
+	spin_lock_irqsave(&emu->lock, flags);
+	hym8563_emu_sync(emu, hym8563_emu_now(emu));
+	memcpy(regs, emu->regs, HYM8563_REG_LEN);
+	raise = hym8563_emu_update(emu);
+	spin_unlock_irqrestore(&emu->lock, flags);
+
+	hym8563_emu_raise(emu, raise);
+}
+
+struct hym8563_emu_counts {
+	unsigned long	xfers;
+	unsigned long	reads;
+	unsigned long	writes;
+	unsigned long	bytes;
+};
+
+static void hym8563_emu_counts(struct hym8563_emu *emu,
+			       struct hym8563_emu_counts *c)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&emu->lock, flags);
+	c->xfers = emu->xfers;
+	c->reads = emu->reads;
+	c->writes = emu->writes;
+	c->bytes = emu->bytes;
+	spin_unlock_irqrestore(&emu->lock, flags);
+}
+
+#ifdef CONFIG_DEBUG_FS
+static int hym8563_emu_xfers_show(struct seq_file *s, void *unused)
+{
+	struct hym8563_emu_counts c;
+
+	hym8563_emu_counts(s->private, &c);
+	seq_printf(s, "transfers %lu\nreads %lu\nwrites %lu\nbytes %lu\n",
+		   c.xfers, c.reads, c.writes, c.bytes);
+	return 0;
+}
+
+static int hym8563_emu_xfers_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, hym8563_emu_xfers_show, inode->i_private);
+}
+
+static ssize_t hym8563_emu_xfers_write(struct file *file,
+				       const char __user *buf,
+				       size_t count, loff_t *ppos)
+{
+	struct hym8563_emu *emu = ((struct seq_file *)file->private_data)->private;
+	unsigned long flags;
+
+	spin_lock_irqsave(&emu->lock, flags);
+	emu->xfers = 0;
+	emu->reads = 0;
+	emu->writes = 0;
+	emu->bytes = 0;
+	spin_unlock_irqrestore(&emu->lock, flags);
+	return count;
+}
+
+static const struct file_operations hym8563_emu_xfers_fops = {
+	.owner		= THIS_MODULE,
+	.open		= hym8563_emu_xfers_open,
+	.read		= seq_read,
+	.write		= hym8563_emu_xfers_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static ssize_t hym8563_emu_advance_write(struct file *file,
+					 const char __user *buf,
+					 size_t count, loff_t *ppos)
+{
+	u64 ns;
+	int ret;
+
+	ret = kstrtou64_from_user(buf, count, 0, &ns);
+	if (ret)
+		return ret;
+	if (ns > (u64)HYM8563_EMU_ADVANCE_MAX_S * NSEC_PER_SEC)
+		return -ERANGE;
+
+	hym8563_emu_advance(file->private_data, ns);
+	return count;
+}
+
+static const struct file_operations hym8563_emu_advance_fops = {
+	.owner		= THIS_MODULE,
+	.open		= simple_open,
+	.write		= hym8563_emu_advance_write,
+	.llseek		= no_llseek,
+};
+
+static int hym8563_emu_regs_show(struct seq_file *s, void *unused)
+{
+	u8 regs[HYM8563_REG_LEN];
+	int i;
+
+	hym8563_emu_read_regs(s->private, regs);
+	for (i = 0; i < HYM8563_REG_LEN; i++)
+		seq_printf(s, "%02x: %02x\n", i, regs[i]);
+	return 0;
+}
+
+static int hym8563_emu_regs_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, hym8563_emu_regs_show, inode->i_private);
+}
+
+static const struct file_operations hym8563_emu_regs_fops = {
+	.owner		= THIS_MODULE,
+	.open		= hym8563_emu_regs_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static void hym8563_emu_debugfs_init(struct hym8563_emu *emu)
+{
+	emu->debugfs = debugfs_create_dir("hym8563-emu", NULL);
+	if (IS_ERR_OR_NULL(emu->debugfs))
+		return;
+	debugfs_create_file("xfers", 0600, emu->debugfs, emu,
+			    &hym8563_emu_xfers_fops);
+	debugfs_create_file("advance", 0200, emu->debugfs, emu,
+			    &hym8563_emu_advance_fops);
+	debugfs_create_file("regs", 0400, emu->debugfs, emu,
+			    &hym8563_emu_regs_fops);
+}
+#else
+static void hym8563_emu_debugfs_init(struct hym8563_emu *emu)
+{
+}
+#endif
+
+/*
+ * Self test. Each step calls into the driver the way the rtc core or
+ * the exported API would and compares the transfers it cost with what
+ * the driver is designed to spend, so a change that adds bus traffic to
+ * one of these paths fails the module load.
+ */
+struct hym8563_emu_test {
+	struct hym8563_emu	*emu;
+	struct rtc_device	*rtc;
+	struct device		*dev;
+	int			index;
+	struct hym8563_emu_counts before;
+	int			failed;
+};
+
+static void hym8563_emu_begin(struct hym8563_emu_test *t)
+{
+	hym8563_emu_counts(t->emu, &t->before);
+}
+
+/* @reads < 0 leaves the read messages unchecked */
+static void hym8563_emu_expect(struct hym8563_emu_test *t, const char *what,
+			       unsigned long xfers, long reads)
+{
+	struct hym8563_emu_counts now;
+	unsigned long dx, dr;
+
+	hym8563_emu_counts(t->emu, &now);
+	dx = now.xfers - t->before.xfers;
+	dr = now.reads - t->before.reads;
+	if (dx != xfers || (reads >= 0 && dr != reads)) {
+		pr_err("%s: %lu transfers, %lu reads, expected %lu and %ld\n",
+		       what, dx, dr, xfers, reads);
+		t->failed++;
+	} else {
+		pr_info("%s: %lu transfers\n", what, dx);
+	}
+}
+
+static void hym8563_emu_check(struct hym8563_emu_test *t, bool ok,
+			      const char *what)
+{
+	if (!ok) {
+		pr_err("%s\n", what);
+		t->failed++;
+	}
+}
+
+static int hym8563_emu_op_read_time(struct hym8563_emu_test *t,
+				    struct rtc_time *tm)
+{
+	int ret;
+
+	mutex_lock(&t->rtc->ops_lock);
+	ret = t->rtc->ops->read_time(t->dev, tm);
+	mutex_unlock(&t->rtc->ops_lock);
+	return ret;
+}
+
+static int hym8563_emu_op_set_time(struct hym8563_emu_test *t,
+				   struct rtc_time *tm)
+{
+	int ret;
+
+	mutex_lock(&t->rtc->ops_lock);
+	ret = t->rtc->ops->set_time(t->dev, tm);
+	mutex_unlock(&t->rtc->ops_lock);
+	return ret;
+}
+
+static int hym8563_emu_op_set_alarm(struct hym8563_emu_test *t,
+				    unsigned long sec)
+{
+	struct rtc_wkalrm alrm = { .enabled = 1 };
+	int ret;
+
+	rtc_time_to_tm(sec, &alrm.time);
+	mutex_lock(&t->rtc->ops_lock);
+	ret = t->rtc->ops->set_alarm(t->dev, &alrm);
+	mutex_unlock(&t->rtc->ops_lock);
+	return ret;
+}
+
+static int hym8563_emu_op_alarm_enable(struct hym8563_emu_test *t,
+				       bool enabled)
+{
+	int ret;
+
+	mutex_lock(&t->rtc->ops_lock);
+	ret = t->rtc->ops->alarm_irq_enable(t->dev, enabled);
+	mutex_unlock(&t->rtc->ops_lock);
+	return ret;
+}
+
+/* current chip time, read past the driver */
+static unsigned long hym8563_emu_chip_time(struct hym8563_emu *emu)
+{
+	unsigned long flags, sec;
+
+	spin_lock_irqsave(&emu->lock, flags);
+	hym8563_emu_sync(emu, hym8563_emu_now(emu));
+	sec = hym8563_emu_time(emu);
+	spin_unlock_irqrestore(&emu->lock, flags);
+	return sec;
+}
+
+/* wait for an interrupt raised by the model and the rtc core work after it */
+static void hym8563_emu_settle(struct hym8563_emu_test *t)
+{
+	irq_work_sync(&t->emu->irq_work);
+	synchronize_irq(t->emu->irq);
+	flush_work(&t->rtc->irqwork);
+}
+
+static void hym8563_emu_test_time(struct hym8563_emu_test *t)
+{
+	struct rtc_time tm, set = {
+		.tm_year = 121, .tm_mon = 2, .tm_mday = 4,
+		.tm_hour = 5, .tm_min = 6, .tm_sec = 7, .tm_wday = 4,
+	};
+	u8 regs[HYM8563_REG_LEN];
+	int ret;
+
+	hym8563_emu_begin(t);
+	ret = hym8563_emu_op_read_time(t, &tm);
+	hym8563_emu_expect(t, "read_time", 1, 1);
+	if (vl) {
+		/* probe found VL and put the chip at its default time */
+		hym8563_emu_check(t, !ret && tm.tm_year == 111 &&
+				  tm.tm_mon == 0 && tm.tm_mday == 1 &&
+				  tm.tm_hour == 12 && tm.tm_min == 0 &&
+				  tm.tm_sec < 10,
+				  "VL at boot did not set 2011-01-01 12:00:00");
+		hym8563_emu_read_regs(t->emu, regs);
+		hym8563_emu_check(t, !(regs[RTC_SEC] & VL), "VL still set");
+	}
+
+	hym8563_emu_begin(t);
+	ret = hym8563_emu_op_set_time(t, &set);
+	hym8563_emu_expect(t, "set_time", 1, 0);
+	hym8563_emu_check(t, !ret && hym8563_emu_chip_time(t->emu) -
+			  mktime64(2021, 3, 4, 5, 6, 7) < 2,
+			  "set_time did not reach the chip");
+}
+
+static void hym8563_emu_test_alarm(struct hym8563_emu_test *t)
+{
+	u8 regs[HYM8563_REG_LEN];
+	unsigned long now, at;
+	struct rtc_time tm;
+	int id;
+
+	/* within 255 s the 1 Hz countdown runs to the deadline */
+	now = hym8563_emu_chip_time(t->emu);
+	hym8563_emu_begin(t);
+	hym8563_emu_op_set_alarm(t, now + 10);
+	hym8563_emu_expect(t, "set_alarm 10 s ahead", 3, 1);
+	hym8563_emu_read_regs(t->emu, regs);
+	hym8563_emu_check(t, regs[RTC_T_CTL] == (TE | TD1) &&
+			  regs[RTC_T_COUNT] >= 8 && regs[RTC_T_COUNT] <= 10 &&
+			  (regs[RTC_CTL2] & (AIE | TIE)) == TIE,
+			  "10 s alarm did not start the 1 Hz countdown");
+
+	/* past 255 min only the minute alarm reaches */
+	at = now + 5 * 3600;
+	hym8563_emu_begin(t);
+	hym8563_emu_op_set_alarm(t, at);
+	hym8563_emu_expect(t, "set_alarm 5 h ahead", 3, 1);
+	rtc_time_to_tm(at, &tm);
+	hym8563_emu_read_regs(t->emu, regs);
+	hym8563_emu_check(t, regs[RTC_A_MIN] == bin2bcd(tm.tm_min) &&
+			  regs[RTC_A_HOUR] == bin2bcd(tm.tm_hour) &&
+			  regs[RTC_A_DAY] == bin2bcd(tm.tm_mday) &&
+			  !(regs[RTC_T_CTL] & TE) &&
+			  (regs[RTC_CTL2] & (AIE | TIE)) == AIE,
+			  "5 h alarm did not program the minute alarm");
+
+	/* the head is unchanged, the chip is not touched */
+	hym8563_emu_begin(t);
+	id = xh_rtc_add_alarm_idx(t->index, at + 3600);
+	hym8563_emu_expect(t, "add a later alarm", 0, 0);
+	hym8563_emu_check(t, id > 0, "xh_rtc_add_alarm_idx failed");
+	hym8563_emu_begin(t);
+	if (id > 0)
+		xh_rtc_del_alarm_idx(t->index, id);
+	hym8563_emu_expect(t, "delete a later alarm", 0, 0);
+
+	hym8563_emu_begin(t);
+	hym8563_emu_op_alarm_enable(t, false);
+	hym8563_emu_expect(t, "cancel", 1, 0);
+	hym8563_emu_read_regs(t->emu, regs);
+	hym8563_emu_check(t, !(regs[RTC_CTL2] & (AIE | TIE)),
+			  "cancel left an interrupt enabled");
+}
+
+static void hym8563_emu_test_irq(struct hym8563_emu_test *t)
+{
+	struct rtc_wkalrm alrm;
+	u8 regs[HYM8563_REG_LEN];
+	unsigned long now;
+
+	now = hym8563_emu_chip_time(t->emu);
+	hym8563_emu_begin(t);
+	hym8563_emu_op_set_alarm(t, now + 3);
+	hym8563_emu_expect(t, "set_alarm 3 s ahead", 3, 1);
+
+	/*
+	 * The interrupt thread acks, reads the time once and stops the
+	 * timer in one burst plus CTL2; the rtc core then reads the time
+	 * and finds nothing left to arm.
+	 */
+	hym8563_emu_begin(t);
+	hym8563_emu_advance(t->emu, 3 * NSEC_PER_SEC);
+	hym8563_emu_settle(t);
+	hym8563_emu_expect(t, "timer interrupt", 5, 2);
+
+	hym8563_emu_read_regs(t->emu, regs);
+	hym8563_emu_check(t, !(regs[RTC_T_CTL] & TE) &&
+			  !(regs[RTC_CTL2] & (AF | TF | AIE | TIE)),
+			  "timer still armed after the interrupt");
+	mutex_lock(&t->rtc->ops_lock);
+	t->rtc->ops->read_alarm(t->dev, &alrm);
+	mutex_unlock(&t->rtc->ops_lock);
+	hym8563_emu_check(t, !alrm.enabled, "alarm still queued after firing");
+}
+
+#ifdef CONFIG_COMMON_CLK
+/* clkout settings are cached, changing one is a single write */
+static void hym8563_emu_test_clk(struct hym8563_emu_test *t)
+{
+	u8 regs[HYM8563_REG_LEN];
+	struct clk *clk;
+	int ret;
+
+	clk = clk_get(t->dev, NULL);
+	if (IS_ERR(clk)) {
+		pr_err("no clkout: %ld\n", PTR_ERR(clk));
+		t->failed++;
+		return;
+	}
+
+	hym8563_emu_begin(t);
+	ret = clk_prepare(clk);
+	hym8563_emu_expect(t, "clkout prepare", 1, 0);
+	hym8563_emu_begin(t);
+	ret |= clk_set_rate(clk, 1024);
+	hym8563_emu_expect(t, "clkout set_rate", 1, 0);
+	hym8563_emu_read_regs(t->emu, regs);
+	hym8563_emu_check(t, !ret && regs[RTC_CLKOUT] == (FE | FD0),
+			  "clkout not at 1024 Hz");
+	hym8563_emu_begin(t);
+	clk_unprepare(clk);
+	hym8563_emu_expect(t, "clkout unprepare", 1, 0);
+	clk_put(clk);
+}
+#endif
+
+static int hym8563_emu_match_rtc(struct device *dev, void *data)
+{
+	const char *name = dev_name(dev);
+
+	return !strncmp(name, "rtc", 3) && isdigit(name[3]);
+}
+
+static int hym8563_emu_match_xhrtc(struct device *dev, void *data)
+{
+	return !strncmp(dev_name(dev), "xh_rtc", 6);
+}
+
+static int hym8563_emu_selftest(struct hym8563_emu *emu)
+{
+	struct hym8563_emu_test t = { .emu = emu, .dev = &emu->client->dev };
+	struct device *rtc_dev, *xh_dev = NULL;
+	int i;
+
+	/* the driver probes asynchronously as a module */
+	wait_for_device_probe();
+	if (!t.dev->driver) {
+		pr_err("rtc-hym8563 did not bind, load it first\n");
+		return -ENODEV;
+	}
+	/* /dev/xh_rtc comes from the deferred part of probe, after the rearm */
+	for (i = 0; i < 200 && !xh_dev; i++) {
+		xh_dev = device_find_child(t.dev, NULL, hym8563_emu_match_xhrtc);
+		if (!xh_dev)
+			msleep(10);
+	}
+	rtc_dev = device_find_child(t.dev, NULL, hym8563_emu_match_rtc);
+	if (!xh_dev || !rtc_dev ||
+	    kstrtoint(dev_name(xh_dev) + 6, 10, &t.index)) {
+		pr_err("driver did not finish probing\n");
+		put_device(xh_dev);
+		put_device(rtc_dev);
+		return -ENODEV;
+	}
+	t.rtc = to_rtc_device(rtc_dev);
+
+	hym8563_emu_test_time(&t);
+	hym8563_emu_test_alarm(&t);
+	hym8563_emu_test_irq(&t);
+#ifdef CONFIG_COMMON_CLK
+	hym8563_emu_test_clk(&t);
+#endif
+
+	put_device(xh_dev);
+	put_device(rtc_dev);
+	if (t.failed) {
+		pr_err("selftest: %d checks failed\n", t.failed);
+		return -EINVAL;
+	}
+	pr_info("selftest passed\n");
+	return 0;
+}
+
+/* power-on state, with the calendar at 2000-01-01 00:00:00 */
+static void hym8563_emu_reset(struct hym8563_emu *emu)
+{
+	u8 *regs = emu->regs;
+
+	memset(regs, 0, HYM8563_REG_LEN);
+	regs[RTC_CTL1] = 0x08;
+	regs[RTC_SEC] = vl ? VL : 0;
+	regs[RTC_DAY] = 0x01;
+	regs[RTC_WEEK] = 6;
+	regs[RTC_MON] = 0x01;
+	regs[RTC_A_MIN] = 0x80;
+	regs[RTC_A_HOUR] = 0x80;
+	regs[RTC_A_DAY] = 0x80;
+	regs[RTC_A_WEEK] = 0x80;
+	regs[RTC_CLKOUT] = FE;
+	regs[RTC_T_CTL] = TD0 | TD1;
+}
+
+static void hym8563_emu_destroy(struct hym8563_emu *emu)
+{
+	unsigned long flags;
+
+	debugfs_remove_recursive(emu->debugfs);
+	if (emu->client)
+		i2c_unregister_device(emu->client);
+	i2c_del_adapter(&emu->adap);
+
+	spin_lock_irqsave(&emu->lock, flags);
+	emu->dying = true;
+	spin_unlock_irqrestore(&emu->lock, flags);
+	hrtimer_cancel(&emu->timer);
+	irq_work_sync(&emu->irq_work);
+	irq_free_desc(emu->irq);
+	kfree(emu);
+}
+
+static int __init hym8563_emu_init(void)
+{
+	struct i2c_board_info info = {
+		I2C_BOARD_INFO("hym8563", HYM8563_EMU_ADDR),
+	};
+	struct hym8563_emu *emu;
+	int ret;
+
+	emu = kzalloc(sizeof(*emu), GFP_KERNEL);
+	if (!emu)
+		return -ENOMEM;
+
+	spin_lock_init(&emu->lock);
+	hym8563_emu_reset(emu);
+	emu->epoch = ktime_get();
+	hrtimer_init(&emu->timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	emu->timer.function = hym8563_emu_timer;
+	init_irq_work(&emu->irq_work, hym8563_emu_irq_work);
+
+	emu->irq = irq_alloc_desc(NUMA_NO_NODE);
+	if (emu->irq < 0) {
+		ret = emu->irq;
+		kfree(emu);
+		return ret;
+	}
+	irq_set_chip_and_handler(emu->irq, &dummy_irq_chip, handle_simple_irq);
+	irq_modify_status(emu->irq, IRQ_NOREQUEST | IRQ_NOAUTOEN, IRQ_NOPROBE);
+
+	emu->adap.owner = THIS_MODULE;
+	emu->adap.algo = &hym8563_emu_algo;
+	strlcpy(emu->adap.name, "hym8563-emu", sizeof(emu->adap.name));
+	i2c_set_adapdata(&emu->adap, emu);
+	ret = i2c_add_adapter(&emu->adap);
+	if (ret) {
+		irq_free_desc(emu->irq);
+		kfree(emu);
+		return ret;
+	}
+
+	hym8563_emu_debugfs_init(emu);
+	info.irq = emu->irq;
+	emu->client = i2c_new_device(&emu->adap, &info);
+	if (!emu->client) {
+		hym8563_emu_destroy(emu);
+		return -ENODEV;
+	}
+
+	/* a failed selftest fails the load, so modprobe reports it */
+	if (selftest) {
+		ret = hym8563_emu_selftest(emu);
+		if (ret) {
+			hym8563_emu_destroy(emu);
+			return ret;
+		}
+	}
+
+	hym8563_emu = emu;
+	return 0;
+}
+
+static void __exit hym8563_emu_exit(void)
+{
+	hym8563_emu_destroy(hym8563_emu);
+}
+
+MODULE_DESCRIPTION("HYM8563 register model on a software i2c adapter");
+MODULE_LICENSE("GPL");
+
+module_init(hym8563_emu_init);
+module_exit(hym8563_emu_exit);
@@ -20,18 +20,128 @@
 #include <linux/bcd.h>
 #include <linux/rtc.h>
 #include <linux/delay.h>
-#include <linux/wakelock.h>
 #include <linux/slab.h>
 #include <linux/miscdevice.h>
 #include <linux/clk-provider.h>
+#include <linux/clkdev.h>
 #include <linux/time.h>
 #include "rtc-HYM8563.h"
 #include <linux/of_gpio.h>
 #include <linux/irqdomain.h>
-#define RTC_SPEED 	200 * 1000
+#include <linux/regmap.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/timerqueue.h>
+#include <linux/idr.h>
+#include <linux/workqueue.h>
+#include <linux/poll.h>
+#include <linux/mm.h>
+#include <linux/version.h>
+#include <linux/rwsem.h>
+#include <linux/sched.h>
+#if IS_ENABLED(CONFIG_PPS)
+#include <linux/pps_kernel.h>
+#endif
+/* the nvmem core of these kernels accesses a provider through its regmap */
+#if IS_ENABLED(CONFIG_NVMEM) && LINUX_VERSION_CODE >= KERNEL_VERSION(4, 3, 0) && \
+	LINUX_VERSION_CODE < KERNEL_VERSION(4, 8, 0)
+#define HYM8563_NVMEM
+#include <linux/nvmem-provider.h>
+#endif
+/* abs() truncates 64-bit values to int before 4.5, abs64() is gone in 4.6 */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 5, 0)
+#undef abs
+#define abs(x)	abs64(x)
+#endif
 
 #define    XHRTC_SET_ALARM             0x1f2
 #define    XHRTC_CANALE_ALARM          0x1f3
+#define    XHRTC_ALARM_BATCH           0x1f4
+#define    XHRTC_GET_TIME              0x1f5
+/* periodic ticks from the chip timer: 1, 64 or 4096 Hz by value, 0 = off */
+#define    XHRTC_SET_PERIODIC          0x1f6
+
+/*
+ * XHRTC_ALARM_BATCH installs, moves or cancels up to XHRTC_BATCH_MAX
+ * alarms and programs the chip once for the whole batch. An entry with
+ * id 0 installs a new alarm, a non-zero id moves or, with
+ * XHRTC_ENTRY_CANCEL, cancels an alarm from an earlier batch.
+ * XHRTC_BATCH_REPLACE cancels every earlier batch alarm first, so
+ * it only accepts new entries. Either the whole batch is applied or none
+ * of it, also when the chip cannot be programmed for it; only alarms
+ * already due by then fire anyway. On success each armed entry gets its
+ * id written back and the ioctl returns the number of armed entries.
+ */
+#define XHRTC_BATCH_REPLACE	BIT(0)
+#define XHRTC_ENTRY_CANCEL	BIT(0)
+#define XHRTC_BATCH_MAX		64
+
+struct xhrtc_batch_entry {
+	__s64	tv_sec;		/* RTC time, struct __kernel_timespec layout */
+	__s64	tv_nsec;
+	__s32	id;
+	__u32	flags;
+};
+
+struct xhrtc_alarm_batch {
+	__u32	flags;
+	__u32	count;
+	__u64	entries;	/* user pointer to count struct xhrtc_batch_entry */
+};
+
+/*
+ * XHRTC_GET_TIME returns the drift corrected RTC time with sub-second
+ * resolution. The first call, and the first after set_time, polls for a
+ * seconds edge and may take up to a second.
+ */
+struct xhrtc_time {
+	__s64	tv_sec;
+	__s64	tv_nsec;
+};
+
+/*
+ * Records returned by read() on /dev/xh_rtc, one per queued alarm that
+ * expired. id is 0 for the XHRTC_SET_ALARM slot, the value returned by
+ * xh_rtc_add_alarm() for kernel users and -1 for the rtc class alarm.
+ */
+#define XHRTC_EVENT_EXPIRED	0	/* already due when queued */
+#define XHRTC_EVENT_TIMER	1	/* countdown timer fired */
+#define XHRTC_EVENT_ALARM	2	/* minute alarm fired */
+#define XHRTC_EVENT_PERIODIC	3	/* id ticks since the previous record */
+
+struct xhrtc_event {
+	__s32	id;
+	__u32	source;
+	__s64	expires_ns;	/* programmed expiry, RTC time */
+	__s64	irq_ns;		/* CLOCK_MONOTONIC when the interrupt fired */
+};
+
+/* must be a power of two */
+#define XHRTC_EVENT_RING	64
+
+/*
+ * Read-only page mapped by mmap() on /dev/xh_rtc. seq is odd while the
+ * driver updates the page; readers retry until they see the same even
+ * value before and after copying the fields. Current RTC time is
+ * rtc_sec + (CLOCK_MONOTONIC - mono_ns), scaled by drift_ppb. Without
+ * XHRTC_SNAPSHOT_EDGE the sample is taken at an unknown point of its
+ * second, so the result may trail the chip by less than one second; with
+ * it mono_ns is the instant rtc_sec began, to within about a millisecond.
+ * CLOCK_MONOTONIC stops in suspend, so XHRTC_SNAPSHOT_VALID is cleared
+ * there and only comes back with the first hardware read after resume.
+ * tools/xhrtc_snapshot.h has a reader.
+ */
+#define XHRTC_SNAPSHOT_VALID	BIT(0)
+#define XHRTC_SNAPSHOT_EDGE	BIT(1)
+
+struct xhrtc_snapshot {
+	__u32	seq;
+	__u32	flags;
+	__s64	rtc_sec;	/* RTC time of the last hardware sample */
+	__s64	mono_ns;	/* CLOCK_MONOTONIC when it was latched */
+	__s32	drift_ppb;	/* calibrated crystal drift, 0 if unknown */
+	__u32	reserved;
+};
 
 #define HYM8563_CLKOUT		0x0d
 #define HYM8563_CLKOUT_ENABLE	BIT(7)
@@ -41,851 +151,3803 @@
 #define HYM8563_CLKOUT_1	3
 #define HYM8563_CLKOUT_MASK	3
 
+#define HYM8563_SEC_VL		BIT(7)
+
+static unsigned int cache_interval_ms;
+module_param(cache_interval_ms, uint, 0644);
+MODULE_PARM_DESC(cache_interval_ms, "serve read_time from a known seconds edge, checking the chip every this many ms (0 = off)");
+
+static bool verify_writes;
+module_param(verify_writes, bool, 0644);
+MODULE_PARM_DESC(verify_writes, "read back register bursts committed by alarm programming");
+
+#define HYM8563_MAX_ALARMS	1024
+#define HYM8563_LATENCY_BUCKETS	20
+/* keeps the system up while the irq thread delivers the wakeup */
+#define HYM8563_WAKEUP_MS	500
+
+/* driver entry points that bus transfers and statistics are charged to */
+enum hym8563_op {
+	HYM8563_OP_READ_TIME,
+	HYM8563_OP_SET_TIME,
+	HYM8563_OP_SET_ALARM,
+	HYM8563_OP_IRQ,
+	HYM8563_OP_CLKOUT,
+	HYM8563_OP_IOCTL,
+	HYM8563_OP_SUSPEND,
+	HYM8563_OP_RESUME,
+	HYM8563_OP_OTHER,	/* probe, shutdown, hdmi data */
+	HYM8563_NR_OPS,
+};
+
+struct hym8563_op_stats {
+	unsigned long	calls;
+	unsigned long	errors;
+	unsigned long	xfers;
+	unsigned long	xfer_errors;
+	unsigned long	locks;
+	u64		lock_wait_ns;
+	u64		lock_wait_max_ns;
+	/* call duration, bucket n counts [2^(n-1), 2^n) us */
+	unsigned long	latency[HYM8563_LATENCY_BUCKETS];
+};
+
+static bool async_program;
+module_param(async_program, bool, 0644);
+MODULE_PARM_DESC(async_program, "coalesce alarm programming in a work item instead of writing from set_alarm");
+
+static bool defer_scratch;
+module_param(defer_scratch, bool, 0644);
+MODULE_PARM_DESC(defer_scratch, "write the scratch byte back from a work item instead of the caller");
+
+static bool precise_time;
+module_param(precise_time, bool, 0644);
+MODULE_PARM_DESC(precise_time, "align set_time to the seconds edge and track it for sub-second reads");
+
+struct hym8563_alarm {
+	struct timerqueue_node	node;
+	int			owner;
+	int			id;
+};
+
+/* one step towards the queue head, see hym8563_program_alarm() */
+struct hym8563_stage {
+	s64			target;		/* RTC time in ns, true time */
+	u32			src;		/* XHRTC_EVENT_TIMER or _ALARM */
+	bool			exact;		/* fires at target, not before it */
+	ktime_t			armed_at;	/* when the commit finished */
+};
+
 struct hym8563 {
 	int irq;
 	struct i2c_client *client;
+	struct regmap *regmap;
 	struct mutex mutex;
 	struct rtc_device *rtc;
 	struct rtc_wkalrm alarm;
-	struct wake_lock wake_lock;
+	/* enable_irq_wake() done for this sleep, see hym8563_suspend_noirq() */
+	bool irq_wake;
+	/* the next interrupt is the wakeup, see hym8563_wake_account() */
+	atomic_t wake_check;
+	ktime_t suspend_stamp;
+	/* under stats_lock */
+	unsigned long wake_alarm;
+	unsigned long wake_timer;
+
+	/* software alarm queue, see hym8563_alarm_rearm() */
+	struct mutex		alarm_lock;
+	struct timerqueue_head	alarms;
+	struct idr		alarm_idr;
+	unsigned int		nr_alarms;
+	struct hym8563_alarm	rtc_alarm;
+	struct hym8563_alarm	xh_alarm;
+	bool			armed;
+	ktime_t			armed_expires;
+
+	/*
+	 * The stage on the chip changes with the mutex held, in the same
+	 * section as its commit, so the interrupt handler latches exactly the
+	 * stage its ack belongs to. The latched copy is handed on to
+	 * hym8563_alarm_rearm() under alarm_lock.
+	 */
+	struct hym8563_stage	stage;		/* mutex */
+	bool			stage_live;	/* mutex */
+	struct hym8563_stage	fired;		/* alarm_lock */
+	bool			stage_fired;	/* alarm_lock */
+	/* 1 Hz countdown of 1 left running, alarm_lock and mutex held to change */
+	bool			tick_running;
+
+	/*
+	 * Periodic ticks own the timer while pie_hz is set, see
+	 * hym8563_pie_set(). It changes with alarm_lock and the mutex held,
+	 * the interrupt handlers read it once without. pie_base_ns is the
+	 * time at pie_base_stamp, alarm_lock held.
+	 */
+	unsigned int		pie_hz;
+	unsigned int		pie_suspended_hz;
+	atomic_t		pie_ticks;
+	s64			pie_base_ns;
+	ktime_t			pie_base_stamp;
+	ktime_t			irq_stamp;
+	ktime_t			hardirq_stamp;
+	/* an interrupt whose ack failed, see hym8563_ack_retry() */
+	struct delayed_work	ack_work;
+	ktime_t			ack_stamp;
+
+	/* hard irq to rtc_update_irq(), log2 us buckets */
+	unsigned long		irq_latency[HYM8563_LATENCY_BUCKETS];
+
+	/* deferred programming, see hym8563_alarm_update() */
+	bool			async_program;
+	struct work_struct	rearm_work;
+	/* probe steps hctosys does not wait for, see hym8563_late_init() */
+	struct work_struct	init_work;
+
+	/*
+	 * T_COUNT doubles as a battery backed scratch byte while the timer
+	 * is stopped, see hym8563_scratch_flush(). timer_owned is under
+	 * alarm_lock, the byte itself under cache_lock.
+	 */
+	u8			scratch;
+	bool			scratch_dirty;
+	bool			timer_owned;
+	struct work_struct	scratch_work;
+	#ifdef HYM8563_NVMEM
+	struct nvmem_device	*nvmem;
+	#endif
+
+	/* xh_rtc<index> and the exported API, see hym8563_find() */
+	struct list_head	node;
+	int			index;
+	char			misc_name[16];
+	struct miscdevice	misc;
+	bool			misc_registered;
+	/*
+	 * Open files hold a reference, so the instance outlives remove();
+	 * gone is set under hym8563_list_sem written and turns them away.
+	 */
+	struct kref		kref;
+	bool			gone;
+	unsigned long		program_requests;
+	unsigned long		program_commits;
+
+	/* /dev/xh_rtc event stream, see hym8563_event_push() */
+	struct xhrtc_event	events[XHRTC_EVENT_RING];
+	unsigned int		event_head;
+	unsigned int		event_tail;
+	unsigned long		event_overruns;
+	struct mutex		event_read_lock;
+	wait_queue_head_t	event_wait;
+
+	/* edge anchored time cache, see hym8563_read_datetime() */
+	spinlock_t		cache_lock;
+	bool			cache_valid;
+	ktime_t			cache_stamp;
+	unsigned int		cache_interval_ms;
+	unsigned long		cache_hits;
+	unsigned long		cache_misses;
+	struct xhrtc_snapshot	*snapshot;
+
+	/* last time seen on the chip, outlives cache invalidation */
+	bool			good_valid;
+	unsigned long		good_sec;
+	ktime_t			good_stamp;
+	unsigned long		fallback_reads;
+
+	/* known seconds edge, cache_lock held, see hym8563_phase_sync() */
+	bool			precise_time;
+	bool			phase_valid;
+	unsigned long		phase_sec;
+	ktime_t			phase_stamp;
+	ktime_t			phase_retry;
+	struct work_struct	phase_work;
+	s64			time_write_ns;
+
+	/* crystal drift, cache_lock held, see hym8563_drift_measure() */
+	s32			drift_ppb;
+	s64			drift_anchor;
+
+	/* interrupt enable bits last written to CTL2, mutex held */
+	u8			ctl2;
+
+	/* register cache statistics, see hym8563_reg_read() */
+	unsigned long		regs_seen;
+	unsigned long		regcache_reads;
+	unsigned long		bus_reads;
+	struct dentry		*debugfs;
+
+	/* per operation statistics, see hym8563_lock(); all under stats_lock */
+	spinlock_t		stats_lock;
+	enum hym8563_op		cur_op;
+	struct hym8563_op_stats	stats[HYM8563_NR_OPS];
 	
 	#ifdef CONFIG_COMMON_CLK
 	struct clk_hw		clkout_hw;
+	struct clk		*clkout;
+	struct clk_lookup	*clkout_lookup;
 	#endif
+
+	/* 1 Hz CLKOUT wired back to a gpio, see hym8563_pps_register() */
+	int			pps_gpio;
+	#if IS_ENABLED(CONFIG_PPS)
+	int			pps_irq;
+	struct pps_device	*pps;
+	struct pps_source_info	pps_info;
+	#endif
+
+	/*
+	 * Adapter without plain I2C, such as i2c-stub: every transfer is an
+	 * SMBus I2C block, which the whole register file fits in.
+	 */
+	bool			smbus;
+
+	/* circuit breaker, regmap lock held, see hym8563_bus_allow() */
+	unsigned int		bus_failures;
+	unsigned int		bus_cooldown_ms;
+	ktime_t			bus_retry_at;
+	unsigned long		bus_trips;
+	/* the interrupt thread, whose transfers skip an open breaker */
+	struct task_struct	*bus_urgent;
+
+	/* register address plus the whole register file, kept DMA-safe */
+	u8			tx_buf[1 + HYM8563_REG_LEN] ____cacheline_aligned;
 };
-static struct i2c_client *gClient = NULL;
-static struct hym8563 *g_hym8563 = NULL;
+static LIST_HEAD(hym8563_list);
+static DECLARE_RWSEM(hym8563_list_sem);
+static DEFINE_IDA(hym8563_ida);
 
-static int i2c_master_reg8_send(const struct i2c_client *client, const char reg, const char *buf, int count, int scl_rate)
+static void hym8563_free(struct kref *kref)
 {
-	struct i2c_adapter *adap=client->adapter;
-	struct i2c_msg msg;
-	int ret;
-	char *tx_buf = (char *)kzalloc(count + 1, GFP_KERNEL);
-	if(!tx_buf)
-		return -ENOMEM;
-	tx_buf[0] = reg;
-	memcpy(tx_buf+1, buf, count); 
+	struct hym8563 *hym8563 = container_of(kref, struct hym8563, kref);
 
-	msg.addr = client->addr;
-	msg.flags = client->flags;
-	msg.len = count + 1;
-	msg.buf = (char *)tx_buf;
-	//msg.scl_rate = scl_rate;
+	/* a live mapping keeps its own reference to the page */
+	free_page((unsigned long)hym8563->snapshot);
+	kfree(hym8563);
+}
 
-	ret = i2c_transfer(adap, &msg, 1);
-	kfree(tx_buf);
-	return (ret == 1) ? count : ret;
+/*
+ * Look up chip @index for the exported API. The caller holds
+ * hym8563_list_sem for reading until it is done with the chip, which
+ * keeps remove() out; calls on different chips run in parallel.
+ */
+static struct hym8563 *hym8563_find(int index)
+{
+	struct hym8563 *hym8563;
 
+	list_for_each_entry(hym8563, &hym8563_list, node)
+		if (hym8563->index == index)
+			return hym8563;
+	return NULL;
 }
 
-static int i2c_master_reg8_recv(const struct i2c_client *client, const char reg, char *buf, int count, int scl_rate)
-{
-	struct i2c_adapter *adap=client->adapter;
-	struct i2c_msg msgs[2];
-	int ret;
-	char reg_buf = reg;
-	
-	msgs[0].addr = client->addr;
-	msgs[0].flags = client->flags;
-	msgs[0].len = 1;
-	msgs[0].buf = &reg_buf;
-	//msgs[0].scl_rate = scl_rate;
+static struct dentry *hym8563_debugfs_root;
 
-	msgs[1].addr = client->addr;
-	msgs[1].flags = client->flags | I2C_M_RD;
-	msgs[1].len = count;
-	msgs[1].buf = (char *)buf;
-	//msgs[1].scl_rate = scl_rate;
+static const char * const hym8563_op_names[HYM8563_NR_OPS] = {
+	[HYM8563_OP_READ_TIME]	= "read_time",
+	[HYM8563_OP_SET_TIME]	= "set_time",
+	[HYM8563_OP_SET_ALARM]	= "set_alarm",
+	[HYM8563_OP_IRQ]	= "irq",
+	[HYM8563_OP_CLKOUT]	= "clkout",
+	[HYM8563_OP_IOCTL]	= "ioctl",
+	[HYM8563_OP_SUSPEND]	= "suspend",
+	[HYM8563_OP_RESUME]	= "resume",
+	[HYM8563_OP_OTHER]	= "other",
+};
 
-	ret = i2c_transfer(adap, msgs, 2);
+static int hym8563_log2_bucket(s64 us)
+{
+	int bucket = us > 0 ? fls64(us) : 0;
 
-	return (ret == 2)? count : ret;
+	return min(bucket, HYM8563_LATENCY_BUCKETS - 1);
 }
 
+/*
+ * Take the bus mutex on behalf of @op. Transfers issued until the
+ * matching hym8563_unlock() are charged to @op.
+ */
+static void hym8563_lock(struct hym8563 *hym8563, enum hym8563_op op)
+{
+	struct hym8563_op_stats *st = &hym8563->stats[op];
+	ktime_t start = ktime_get();
+	u64 wait;
 
+	mutex_lock(&hym8563->mutex);
+	wait = ktime_to_ns(ktime_sub(ktime_get(), start));
+	hym8563->cur_op = op;
+	spin_lock(&hym8563->stats_lock);
+	st->locks++;
+	st->lock_wait_ns += wait;
+	if (wait > st->lock_wait_max_ns)
+		st->lock_wait_max_ns = wait;
+	spin_unlock(&hym8563->stats_lock);
+}
 
-static int hym8563_i2c_read_regs(struct i2c_client *client, u8 reg, u8 buf[], unsigned len)
+static void hym8563_unlock(struct hym8563 *hym8563)
 {
-	int ret; 
-	ret = i2c_master_reg8_recv(client, reg, buf, len, RTC_SPEED);
-	return ret; 
+	hym8563->cur_op = HYM8563_OP_OTHER;
+	mutex_unlock(&hym8563->mutex);
 }
 
-static int hym8563_i2c_set_regs(struct i2c_client *client, u8 reg, u8 const buf[], __u16 len)
+/* account one call of @op that started at @start, returns @ret */
+static int hym8563_op_end(struct hym8563 *hym8563, enum hym8563_op op,
+			  ktime_t start, int ret)
 {
-	int ret; 
-	ret = i2c_master_reg8_send(client, reg, buf, (int)len, RTC_SPEED);
+	struct hym8563_op_stats *st = &hym8563->stats[op];
+	s64 us = ktime_to_us(ktime_sub(ktime_get(), start));
+
+	spin_lock(&hym8563->stats_lock);
+	st->calls++;
+	if (ret < 0)
+		st->errors++;
+	st->latency[hym8563_log2_bucket(us)]++;
+	spin_unlock(&hym8563->stats_lock);
+
 	return ret;
 }
 
+/* called by the bus callbacks, under the regmap lock */
+static void hym8563_xfer_done(struct hym8563 *hym8563, bool write, u8 reg,
+			      size_t len, ktime_t start, int ret)
+{
+	enum hym8563_op op = hym8563->cur_op;
+
+	spin_lock(&hym8563->stats_lock);
+	hym8563->stats[op].xfers++;
+	if (ret < 0)
+		hym8563->stats[op].xfer_errors++;
+	spin_unlock(&hym8563->stats_lock);
+
+	dev_dbg(&hym8563->client->dev, "%s: %s 0x%02x+%zu in %lld ns: %d\n",
+		hym8563_op_names[op], write ? "write" : "read", reg, len,
+		(long long)ktime_to_ns(ktime_sub(ktime_get(), start)), ret);
+}
+
+/*
+ * CTL2 carries the AF/TF flags, the time block counts on its own and
+ * T_COUNT is decremented by the timer; everything else only changes when
+ * the driver writes it and is served from the regmap cache.
+ */
+#define HYM8563_REG_RANGE(reg, len)	((BIT(len) - 1) << (reg))
+#define HYM8563_VOLATILE_REGS	(BIT(RTC_CTL2) | \
+				 HYM8563_REG_RANGE(RTC_SEC, HYM8563_RTC_SECTION_LEN) | \
+				 BIT(RTC_T_COUNT))
 
-int hym8563_enable_count(struct i2c_client *client, int en)
+static bool hym8563_volatile_reg(struct device *dev, unsigned int reg)
 {
-	struct hym8563 *hym8563 = i2c_get_clientdata(client);	
-	u8 regs[2];
+	return HYM8563_VOLATILE_REGS & BIT(reg);
+}
 
-	if (!hym8563)
-		return -1;
+static const struct regmap_config hym8563_regmap_config = {
+	.reg_bits = 8,
+	.val_bits = 8,
+	.max_register = RTC_T_COUNT,
+	.volatile_reg = hym8563_volatile_reg,
+	.cache_type = REGCACHE_RBTREE,
+};
 
-	if (en) {
-		hym8563_i2c_read_regs(client, RTC_CTL2, regs, 1);
-		regs[0] |= TIE;
-		hym8563_i2c_set_regs(client, RTC_CTL2, regs, 1);
-		regs[0] = 0;
-		regs[0] |= (TE | TD1);
-		hym8563_i2c_set_regs(client, RTC_T_CTL, regs, 1);
-	}
-	else {
-		hym8563_i2c_read_regs(client, RTC_CTL2, regs, 1);
-		regs[0] &= ~TIE;
-		hym8563_i2c_set_regs(client, RTC_CTL2, regs, 1);
-		regs[0] = 0;
-		regs[0] |= (TD0 | TD1);
-		hym8563_i2c_set_regs(client, RTC_T_CTL, regs, 1);
+static int hym8563_write_once(struct hym8563 *hym8563, u8 *buf, size_t len)
+{
+	struct i2c_client *client = hym8563->client;
+	struct i2c_msg msg;
+	ktime_t start = ktime_get();
+	int ret;
+
+	if (hym8563->smbus) {
+		ret = i2c_smbus_write_i2c_block_data(client, buf[0], len - 1,
+						     buf + 1);
+		hym8563_xfer_done(hym8563, true, buf[0], len - 1, start, ret);
+		return ret;
 	}
-	return 0;
+
+	msg.addr = client->addr;
+	msg.flags = client->flags;
+	msg.len = len;
+	msg.buf = buf;
+
+	ret = i2c_transfer(client->adapter, &msg, 1);
+	if (ret == 1)
+		ret = 0;
+	else if (ret >= 0)
+		ret = -EIO;
+	hym8563_xfer_done(hym8563, true, buf[0], len - 1, start, ret);
+	return ret;
 }
 
-//0 < sec <=255
-int hym8563_set_count(struct i2c_client *client, int sec)
-{	
-	struct hym8563 *hym8563 = i2c_get_clientdata(client);
-	u8 regs[2];
+/*
+ * A transfer is retried only after a quick failure such as a NACK, with
+ * exponential backoff inside a small budget. One that ran into the
+ * adapter timeout is not repeated, so a stuck bus costs one timeout per
+ * transfer, not several.
+ */
+#define HYM8563_XFER_TRIES	3
+#define HYM8563_XFER_BACKOFF_US	500
+#define HYM8563_XFER_BUDGET_US	(20 * USEC_PER_MSEC)
 
-	if (!hym8563)
-		return -1;
-		
-	if (sec >= 255)
-		regs[0] = 255;
-	else if (sec <= 1)
-		regs[0] = 1;
-	else
-		regs[0] = sec;
-	
-	hym8563_i2c_set_regs(client, RTC_T_COUNT, regs, 1);
-	
-	return 0;
+static bool hym8563_xfer_retry(int ret, int attempt, ktime_t start)
+{
+	unsigned int backoff = HYM8563_XFER_BACKOFF_US << attempt;
+
+	if (ret >= 0 || ret == -ETIMEDOUT || attempt + 1 >= HYM8563_XFER_TRIES)
+		return false;
+	if (ktime_us_delta(ktime_get(), start) + backoff > HYM8563_XFER_BUDGET_US)
+		return false;
+	usleep_range(backoff, 2 * backoff);
+	return true;
 }
 
+/*
+ * After HYM8563_BUS_TRIP failed transfers in a row the breaker opens:
+ * transfers fail at once with -EAGAIN for a cooldown that doubles on
+ * every failed probe. Once it has passed, one transfer is let through;
+ * success closes the breaker. Readers of the time are answered from
+ * hym8563_fallback_read() meanwhile. The interrupt ack and the rearm
+ * after it cannot wait for the cooldown and always go out.
+ */
+#define HYM8563_BUS_TRIP		3
+#define HYM8563_BUS_COOLDOWN_MS		500
+#define HYM8563_BUS_COOLDOWN_MAX_MS	(30 * MSEC_PER_SEC)
 
-/*the init of the hym8563 at first time */
-static int hym8563_init_device(struct i2c_client *client)	
+static bool hym8563_bus_allow(struct hym8563 *hym8563)
 {
-	struct hym8563 *hym8563 = i2c_get_clientdata(client);
-	u8 regs[2];
-	int sr;
+	ktime_t now;
 
-	mutex_lock(&hym8563->mutex);
-	regs[0]=0;
-	sr = hym8563_i2c_set_regs(client, RTC_CTL1, regs, 1);		
-	if (sr < 0)
-		goto exit;
-	
-	//disable clkout
-	regs[0] = 0x80;
-	sr = hym8563_i2c_set_regs(client, RTC_CLKOUT, regs, 1);
-	if (sr < 0)
-		goto exit;
+	if (hym8563->bus_failures < HYM8563_BUS_TRIP ||
+	    ACCESS_ONCE(hym8563->bus_urgent) == current)
+		return true;
+	now = ktime_get();
+	if (ktime_before(now, hym8563->bus_retry_at))
+		return false;
+	/* half open: this transfer probes, the others keep failing fast */
+	hym8563->bus_retry_at = ktime_add_ms(now, hym8563->bus_cooldown_ms);
+	return true;
+}
 
-	/*enable alarm && count interrupt*/
-	sr = hym8563_i2c_read_regs(client, RTC_CTL2, regs, 1);
-	if (sr < 0)
-		goto exit;
-	regs[0] = 0x0;
-	regs[0] |= (AIE | TIE);
-	sr = hym8563_i2c_set_regs(client, RTC_CTL2, regs, 1);
-	if (sr < 0)
-		goto exit;
-	sr = hym8563_i2c_read_regs(client, RTC_CTL2, regs, 1);
-	if (sr < 0)
-		goto exit;
+static void hym8563_bus_result(struct hym8563 *hym8563, int ret)
+{
+	struct i2c_adapter *adap = hym8563->client->adapter;
+	struct device *dev = &hym8563->client->dev;
 
-	sr = hym8563_i2c_read_regs(client, RTC_CTL2, regs, 1);
-	if (sr < 0) {
-		pr_err("read CTL2 err\n");
-		goto exit;
+	if (ret >= 0) {
+		if (hym8563->bus_failures >= HYM8563_BUS_TRIP)
+			dev_info(dev, "bus recovered\n");
+		hym8563->bus_failures = 0;
+		hym8563->bus_cooldown_ms = HYM8563_BUS_COOLDOWN_MS;
+		return;
 	}
-	
-	if(regs[0] & (AF|TF))
-	{
-		regs[0] &= ~(AF|TF);
-		sr = hym8563_i2c_set_regs(client, RTC_CTL2, regs, 1);
+
+	if (++hym8563->bus_failures < HYM8563_BUS_TRIP)
+		return;
+	if (hym8563->bus_failures == HYM8563_BUS_TRIP) {
+		hym8563->bus_trips++;
+		dev_warn(dev, "bus failing (%d), failing fast for %u ms\n",
+			 ret, hym8563->bus_cooldown_ms);
+		/*
+		 * Clocks out a slave holding SDA low, if the adapter can. The
+		 * recovery expects the bus locked, as from a master_xfer.
+		 */
+		if (adap->bus_recovery_info) {
+			i2c_lock_adapter(adap);
+			i2c_recover_bus(adap);
+			i2c_unlock_adapter(adap);
+		}
+	} else {
+		hym8563->bus_cooldown_ms = min_t(unsigned int,
+						 2 * hym8563->bus_cooldown_ms,
+						 HYM8563_BUS_COOLDOWN_MAX_MS);
 	}
-	
-exit:
-	mutex_unlock(&hym8563->mutex);
-	
-	return sr;
+	hym8563->bus_retry_at = ktime_add_ms(ktime_get(), hym8563->bus_cooldown_ms);
 }
 
-static int hym8563_read_datetime(struct i2c_client *client, struct rtc_time *tm)
+static int hym8563_regmap_xfer(struct hym8563 *hym8563, u8 *buf, size_t len)
 {
-	struct hym8563 *hym8563 = i2c_get_clientdata(client);
-	u8 regs[HYM8563_RTC_SECTION_LEN] = { 0, };
-	mutex_lock(&hym8563->mutex);
-//	for (i = 0; i < HYM8563_RTC_SECTION_LEN; i++) {
-//		hym8563_i2c_read_regs(client, RTC_SEC+i, &regs[i], 1);
-//	}
-	hym8563_i2c_read_regs(client, RTC_SEC, regs, HYM8563_RTC_SECTION_LEN);
-
-	mutex_unlock(&hym8563->mutex);
-	
-	tm->tm_sec = bcd2bin(regs[0x00] & 0x7F);
-	tm->tm_min = bcd2bin(regs[0x01] & 0x7F);
-	tm->tm_hour = bcd2bin(regs[0x02] & 0x3F);
-	tm->tm_mday = bcd2bin(regs[0x03] & 0x3F);
-	tm->tm_wday = bcd2bin(regs[0x04] & 0x07);	
-	
-	tm->tm_mon = bcd2bin(regs[0x05] & 0x1F) ; 
-	tm->tm_mon -= 1;			//inorder to cooperate the systerm time
-	
-	tm->tm_year = bcd2bin(regs[0x06] & 0xFF);
-	if(regs[5] & 0x80)
-		tm->tm_year += 1900;
-	else
-		tm->tm_year += 2000;
-		
-	tm->tm_yday = rtc_year_days(tm->tm_mday, tm->tm_mon, tm->tm_year);	
-	
-	tm->tm_year -= 1900;			//inorder to cooperate the systerm time	
-	if(tm->tm_year < 0)
-		tm->tm_year = 0;	
-	tm->tm_isdst = 0;	
+	ktime_t start = ktime_get();
+	int attempt = 0;
+	int ret;
 
-	pr_debug("%4d-%02d-%02d(%d) %02d:%02d:%02d\n",
-		1900 + tm->tm_year, tm->tm_mon + 1, tm->tm_mday, tm->tm_wday,
-		tm->tm_hour, tm->tm_min, tm->tm_sec);
+	if (!hym8563_bus_allow(hym8563))
+		return -EAGAIN;
+	do {
+		ret = hym8563_write_once(hym8563, buf, len);
+	} while (hym8563_xfer_retry(ret, attempt++, start));
+	hym8563_bus_result(hym8563, ret);
+	return ret;
+}
 
-	return 0;
+/*
+ * Single register writes arrive already formatted in the regmap work
+ * buffer, which is kmalloc'ed and can be handed to the adapter as is.
+ */
+static int hym8563_regmap_write(void *context, const void *data, size_t count)
+{
+	return hym8563_regmap_xfer(context, (u8 *)data, count);
 }
 
-static int hym8563_rtc_read_time(struct device *dev, struct rtc_time *tm)
+/*
+ * Burst writes are linearised into the preallocated transmit buffer
+ * instead of letting the regmap core allocate one per transfer. Bus
+ * callbacks are serialised by the regmap lock.
+ */
+static int hym8563_regmap_gather_write(void *context,
+				       const void *reg, size_t reg_len,
+				       const void *val, size_t val_len)
 {
-	return hym8563_read_datetime(to_i2c_client(dev), tm);
+	struct hym8563 *hym8563 = context;
+
+	if (reg_len != 1 || val_len > HYM8563_REG_LEN)
+		return -EINVAL;
+
+	hym8563->tx_buf[0] = *(const u8 *)reg;
+	memcpy(hym8563->tx_buf + 1, val, val_len);
+	return hym8563_regmap_xfer(hym8563, hym8563->tx_buf, val_len + 1);
 }
 
-static int hym8563_set_time(struct i2c_client *client, struct rtc_time *tm)	
+static int hym8563_read_once(struct hym8563 *hym8563,
+			     const void *reg, size_t reg_len,
+			     void *val, size_t val_len)
 {
-	struct hym8563 *hym8563 = i2c_get_clientdata(client);
-	u8 regs[HYM8563_RTC_SECTION_LEN] = { 0, };
-	u8 mon_day;
-	//u8 ret = 0;
+	struct i2c_client *client = hym8563->client;
+	struct i2c_msg msgs[2];
+	ktime_t start = ktime_get();
+	int ret;
 
-	pr_debug("%4d-%02d-%02d(%d) %02d:%02d:%02d\n",
-		1900 + tm->tm_year, tm->tm_mon + 1, tm->tm_mday, tm->tm_wday,
-		tm->tm_hour, tm->tm_min, tm->tm_sec);
+	if (hym8563->smbus) {
+		ret = i2c_smbus_read_i2c_block_data(client, *(const u8 *)reg,
+						    val_len, val);
+		if (ret >= 0)
+			ret = ret == val_len ? 0 : -EIO;
+		hym8563_xfer_done(hym8563, false, *(const u8 *)reg, val_len,
+				  start, ret);
+		return ret;
+	}
 
-	mon_day = rtc_month_days((tm->tm_mon), tm->tm_year + 1900);
-	
-	if(tm->tm_sec >= 60 || tm->tm_sec < 0 )		//set  sec
-		regs[0x00] = bin2bcd(0x00);
-	else
-		regs[0x00] = bin2bcd(tm->tm_sec);
-	
-	if(tm->tm_min >= 60 || tm->tm_min < 0 )		//set  min	
-		regs[0x01] = bin2bcd(0x00);
-	else
-		regs[0x01] = bin2bcd(tm->tm_min);
+	msgs[0].addr = client->addr;
+	msgs[0].flags = client->flags;
+	msgs[0].len = reg_len;
+	msgs[0].buf = (u8 *)reg;
 
-	if(tm->tm_hour >= 24 || tm->tm_hour < 0 )		//set  hour
-		regs[0x02] = bin2bcd(0x00);
-	else
-		regs[0x02] = bin2bcd(tm->tm_hour);
-	
-	if((tm->tm_mday) > mon_day)				//if the input month day is bigger than the biggest day of this month, set the biggest day 
-		regs[0x03] = bin2bcd(mon_day);
-	else if((tm->tm_mday) > 0)
-		regs[0x03] = bin2bcd(tm->tm_mday);
-	else if((tm->tm_mday) <= 0)
-		regs[0x03] = bin2bcd(0x01);
+	msgs[1].addr = client->addr;
+	msgs[1].flags = client->flags | I2C_M_RD;
+	msgs[1].len = val_len;
+	msgs[1].buf = val;
 
-	if( tm->tm_year >= 200)		// year >= 2100
-		regs[0x06] = bin2bcd(99);	//year = 2099
-	else if(tm->tm_year >= 100)			// 2000 <= year < 2100
-		regs[0x06] = bin2bcd(tm->tm_year - 100);
-	else if(tm->tm_year >= 0){				// 1900 <= year < 2000
-		regs[0x06] = bin2bcd(tm->tm_year);	
-		regs[0x05] |= 0x80;	
-	}else{									// year < 1900
-		regs[0x06] = bin2bcd(0);	//year = 1900	
-		regs[0x05] |= 0x80;	
-	}	
-	regs[0x04] = bin2bcd(tm->tm_wday);		//set  the  weekday
-	regs[0x05] = (regs[0x05] & 0x80)| (bin2bcd(tm->tm_mon + 1) & 0x7F);		//set  the  month
-	
-	mutex_lock(&hym8563->mutex);
-//	for(i=0;i<HYM8563_RTC_SECTION_LEN;i++){
-//		ret = hym8563_i2c_set_regs(client, RTC_SEC+i, &regs[i], 1);
-//	}
-	hym8563_i2c_set_regs(client, RTC_SEC, regs, HYM8563_RTC_SECTION_LEN);
+	ret = i2c_transfer(client->adapter, msgs, 2);
+	if (ret == 2)
+		ret = 0;
+	else if (ret >= 0)
+		ret = -EIO;
+	hym8563_xfer_done(hym8563, false, *(const u8 *)reg, val_len, start, ret);
+	return ret;
+}
 
-	mutex_unlock(&hym8563->mutex);
+static int hym8563_regmap_read(void *context,
+			       const void *reg, size_t reg_len,
+			       void *val, size_t val_len)
+{
+	struct hym8563 *hym8563 = context;
+	ktime_t start = ktime_get();
+	int attempt = 0;
+	int ret;
 
-	return 0;
+	if (!hym8563_bus_allow(hym8563))
+		return -EAGAIN;
+	/* whatever the regmap cache could not answer ends up here */
+	hym8563->bus_reads++;
+	do {
+		ret = hym8563_read_once(hym8563, reg, reg_len, val, val_len);
+	} while (hym8563_xfer_retry(ret, attempt++, start));
+	hym8563_bus_result(hym8563, ret);
+	return ret;
 }
 
-static int hym8563_rtc_set_time(struct device *dev, struct rtc_time *tm)
+static const struct regmap_bus hym8563_regmap_bus = {
+	.write = hym8563_regmap_write,
+	.gather_write = hym8563_regmap_gather_write,
+	.read = hym8563_regmap_read,
+};
+
+/* whether the regmap cache can answer for @reg without a bus read */
+static bool hym8563_reg_cached(struct hym8563 *hym8563, int reg)
 {
-	return hym8563_set_time(to_i2c_client(dev), tm);
+	return !(HYM8563_VOLATILE_REGS & BIT(reg)) &&
+	       (hym8563->regs_seen & BIT(reg));
 }
 
-static int hym8563_rtc_read_alarm(struct device *dev, struct rtc_wkalrm *tm)
+/*
+ * Every register read goes through here or hym8563_i2c_read_regs(), so
+ * reads the cache answers are counted next to the bus reads counted in
+ * hym8563_regmap_read(). A non-volatile register is cached once touched.
+ */
+static int hym8563_reg_read(struct hym8563 *hym8563, u8 reg, unsigned int *val)
 {
-	struct i2c_client *client = to_i2c_client(dev);
-	struct hym8563 *hym8563 = i2c_get_clientdata(client);
-	u8 regs[4] = { 0, };
-	
-	pr_debug("enter\n");
-	mutex_lock(&hym8563->mutex);
-	hym8563_i2c_read_regs(client, RTC_A_MIN, regs, 4);
-	regs[0] = 0x0;
-	regs[0] |= TIE;
-	hym8563_i2c_set_regs(client, RTC_CTL2, regs, 1);
-	mutex_unlock(&hym8563->mutex);
+	int ret;
+
+	if (hym8563_reg_cached(hym8563, reg))
+		hym8563->regcache_reads++;
+	ret = regmap_read(hym8563->regmap, reg, val);
+	if (ret < 0)
+		return ret;
+
+	hym8563->regs_seen |= BIT(reg) & ~HYM8563_VOLATILE_REGS;
 	return 0;
 }
 
-static int hym8563_rtc_set_alarm(struct device *dev, struct rtc_wkalrm *alarm)
-{	
-	struct i2c_client *client = to_i2c_client(dev);
+static int hym8563_reg_update_bits(struct hym8563 *hym8563, u8 reg,
+				   u8 mask, u8 val)
+{
+	int ret;
+
+	if (hym8563_reg_cached(hym8563, reg))
+		hym8563->regcache_reads++;
+	ret = regmap_update_bits(hym8563->regmap, reg, mask, val);
+	if (ret < 0)
+		return ret;
+
+	hym8563->regs_seen |= BIT(reg) & ~HYM8563_VOLATILE_REGS;
+	return 0;
+}
+
+static int hym8563_i2c_read_regs(struct i2c_client *client, u8 reg, u8 buf[], unsigned len)
+{
 	struct hym8563 *hym8563 = i2c_get_clientdata(client);
-	struct rtc_time now, *tm = &alarm->time;
-	u8 regs[4] = { 0, };
-	u8 mon_day;	
-	unsigned long	alarm_sec, now_sec;
-	int diff_sec = 0;
-	
-	printk("%4d-%02d-%02d(%d) %02d:%02d:%02d enabled %d\n",
-		1900 + tm->tm_year, tm->tm_mon + 1, tm->tm_mday, tm->tm_wday,
-		tm->tm_hour, tm->tm_min, tm->tm_sec, alarm->enabled);
-	
-	
-	hym8563_read_datetime(client, &now);
+	unsigned long range = HYM8563_REG_RANGE(reg, len);
+	unsigned int val;
+	int ret; 
 
-	
-	mutex_lock(&hym8563->mutex);
-	rtc_tm_to_time(tm, &alarm_sec);
-	rtc_tm_to_time(&now, &now_sec);
-	
-	diff_sec = alarm_sec - now_sec;
-	
-	if((diff_sec > 0) && (diff_sec < 256))
-	{	
-		printk("%s:diff_sec= %ds , use time\n",__func__, diff_sec);	
-								
-		if (alarm->enabled == 1)
-		{
-			hym8563_set_count(client, diff_sec);
-			hym8563_enable_count(client, 1);
-		}
-			
-		else
-		{
-			hym8563_enable_count(client, 0);
-		}
-		
+	if (len == 1) {
+		ret = hym8563_reg_read(hym8563, reg, &val);
+		if (ret < 0)
+			return ret;
+		buf[0] = val;
+		return len;
 	}
+
+	if (!(range & HYM8563_VOLATILE_REGS) &&
+	    (hym8563->regs_seen & range) == range)
+		hym8563->regcache_reads++;
+	ret = regmap_bulk_read(hym8563->regmap, reg, buf, len);
+	if (ret < 0)
+		return ret;
+
+	hym8563->regs_seen |= range & ~HYM8563_VOLATILE_REGS;
+	return len; 
+}
+
+/*
+ * regmap_bulk_write() duplicates the caller's buffer on every call, so
+ * single registers take the regmap_write() fast path and bursts go
+ * through regmap_raw_write(), which ends up in the gather_write hook.
+ */
+static int hym8563_i2c_set_regs(struct i2c_client *client, u8 reg, u8 const buf[], __u16 len)
+{
+	struct hym8563 *hym8563 = i2c_get_clientdata(client);
+	int ret; 
+
+	if (len == 1)
+		ret = regmap_write(hym8563->regmap, reg, buf[0]);
 	else
-	{				
-		printk("%s:diff_sec= %ds , use alarm\n",__func__, diff_sec);
-		hym8563_enable_count(client, 0);
-		
-		if(tm->tm_sec > 0)
-		{
-			rtc_tm_to_time(tm, &alarm_sec);
-			rtc_time_to_tm(alarm_sec, tm);
-		}
+		ret = regmap_raw_write(hym8563->regmap, reg, buf, len);
+	if (ret < 0)
+		return ret;
 
-		hym8563->alarm = *alarm;
+	hym8563->regs_seen |= HYM8563_REG_RANGE(reg, len) & ~HYM8563_VOLATILE_REGS;
+	return len;
+}
 
-		regs[0] = 0x0;
-		hym8563_i2c_set_regs(client, RTC_CTL2, regs, 1);
-		mon_day = rtc_month_days(tm->tm_mon, tm->tm_year + 1900);
-		hym8563_i2c_read_regs(client, RTC_A_MIN, regs, 4);
+/*
+ * Update the interrupt enables in CTL2 from the driver's shadow copy.
+ * Writing 1 to AF/TF leaves the flags untouched and writing 0 clears
+ * them, so no read-modify-write cycle is needed.
+ */
+static int hym8563_write_ctl2(struct hym8563 *hym8563, bool clear_flags)
+{
+	u8 value = hym8563->ctl2;
 
-		if (tm->tm_min >= 60 || tm->tm_min < 0)		//set  min
-		regs[0x00] = bin2bcd(0x00) & 0x7f;
-		else
-		regs[0x00] = bin2bcd(tm->tm_min) & 0x7f;
-		if (tm->tm_hour >= 24 || tm->tm_hour < 0)	//set  hour
-		regs[0x01] = bin2bcd(0x00) & 0x7f;
-		else
-		regs[0x01] = bin2bcd(tm->tm_hour) & 0x7f;
-		regs[0x03] = bin2bcd (tm->tm_wday) & 0x7f;
-
-		/* if the input month day is bigger than the biggest day of this month, set the biggest day */
-		if (tm->tm_mday > mon_day)
-		regs[0x02] = bin2bcd(mon_day) & 0x7f;
-		else if (tm->tm_mday > 0)
-		regs[0x02] = bin2bcd(tm->tm_mday) & 0x7f;
-		else if (tm->tm_mday <= 0)
-		regs[0x02] = bin2bcd(0x01) & 0x7f;
-
-		hym8563_i2c_set_regs(client, RTC_A_MIN, regs, 4);	
-		hym8563_i2c_read_regs(client, RTC_A_MIN, regs, 4);	
-		hym8563_i2c_read_regs(client, RTC_CTL2, regs, 1);
-		if (alarm->enabled == 1)
-		regs[0] |= AIE;
-		else
-		regs[0] &= 0x0;
-		hym8563_i2c_set_regs(client, RTC_CTL2, regs, 1);
-		hym8563_i2c_read_regs(client, RTC_CTL2, regs, 1);
-		
-		printk("alarm regs[0]=0x%x\n",regs[0]);
-		
-		if(diff_sec <= 0)
-		{		
-			pr_info("alarm sec  <= now sec\n");
-		}			
+	if (!clear_flags)
+		value |= AF | TF;
+	return hym8563_i2c_set_regs(hym8563->client, RTC_CTL2, &value, 1);
+}
 
-	}
-	
-	mutex_unlock(&hym8563->mutex);
+/*
+ * Staged register updates. Callers fill in the registers they want to
+ * change and hym8563_txn_commit() pushes them out in as few bursts as
+ * possible.
+ */
+struct hym8563_txn {
+	u8		regs[HYM8563_REG_LEN];
+	unsigned long	dirty;
+};
 
-	return 0;
+static void hym8563_txn_init(struct hym8563_txn *txn)
+{
+	memset(txn, 0, sizeof(*txn));
 }
 
-static int xh_rtc_set_alarm(struct rtc_wkalrm *alarm)
-{	
-	struct i2c_client *client = gClient;
-	struct hym8563 *hym8563 = g_hym8563;
-	struct rtc_time now, *tm = &alarm->time;
-	u8 regs[4] = { 0, };
-	u8 mon_day;	
-	unsigned long	alarm_sec, now_sec;
-	int diff_sec = 0;
-	
-	printk("%4d-%02d-%02d(%d) %02d:%02d:%02d enabled %d\n",
-		1900 + tm->tm_year, tm->tm_mon + 1, tm->tm_mday, tm->tm_wday,
-		tm->tm_hour, tm->tm_min, tm->tm_sec, alarm->enabled);
-	
-	
-	hym8563_read_datetime(client, &now);
+static void hym8563_txn_stage(struct hym8563_txn *txn, u8 reg, u8 val)
+{
+	txn->regs[reg] = val;
+	txn->dirty |= BIT(reg);
+}
 
-	
-	mutex_lock(&hym8563->mutex);
-	rtc_tm_to_time(tm, &alarm_sec);
-	rtc_tm_to_time(&now, &now_sec);
-	
-	diff_sec = alarm_sec - now_sec;
-	
-	if((diff_sec > 0) && (diff_sec < 256))
-	{	
-		printk("%s:diff_sec= %ds , use time\n",__func__, diff_sec);	
-								
-		if (alarm->enabled == 1)
-		{
-			hym8563_set_count(client, diff_sec);
-			hym8563_enable_count(client, 1);
+/* compare a committed burst against what the chip actually holds */
+static int hym8563_txn_verify(struct hym8563 *hym8563, struct hym8563_txn *txn,
+			      u8 reg, size_t len)
+{
+	u8 buf[HYM8563_REG_LEN];
+	u8 mask;
+	int i, ret;
+
+	ret = hym8563_regmap_read(hym8563, &reg, 1, buf, len);
+	if (ret < 0)
+		return ret;
+
+	for (i = 0; i < len; i++) {
+		switch (reg + i) {
+		case RTC_CTL2:
+			mask = AIE | TIE;
+			break;
+		case RTC_T_COUNT:
+			/* already counting down */
+			mask = 0;
+			break;
+		default:
+			mask = 0xff;
+			break;
 		}
-			
-		else
-		{
-			hym8563_enable_count(client, 0);
+		if ((buf[i] ^ txn->regs[reg + i]) & mask) {
+			dev_err(&hym8563->client->dev,
+				"verify failed at 0x%02x: wrote 0x%02x, read 0x%02x\n",
+				reg + i, txn->regs[reg + i], buf[i]);
+			return -EIO;
 		}
-		
 	}
-	else
-	{				
-		printk("%s:diff_sec= %ds , use alarm\n",__func__, diff_sec);
-		hym8563_enable_count(client, 0);
-		
-		if(tm->tm_sec > 0)
-		{
-			rtc_tm_to_time(tm, &alarm_sec);
-			rtc_time_to_tm(alarm_sec, tm);
-		}
+	return 0;
+}
+
+static int hym8563_txn_write(struct hym8563 *hym8563, struct hym8563_txn *txn,
+			     u8 reg, size_t len)
+{
+	int ret;
+
+	ret = hym8563_i2c_set_regs(hym8563->client, reg, txn->regs + reg, len);
+	if (ret < 0)
+		return ret;
+	if (verify_writes)
+		return hym8563_txn_verify(hym8563, txn, reg, len);
+	return 0;
+}
 
-		hym8563->alarm = *alarm;
+/*
+ * Registers the cache already holds with the staged value are dropped.
+ * The remaining ones are grouped into contiguous bursts, bridging gaps
+ * of cached registers with their cached value. CTL2 goes out last, so
+ * interrupt enables only take effect once the alarm and timer
+ * registers describe the new setup. Must be called with the mutex held.
+ */
+static int hym8563_txn_commit(struct hym8563 *hym8563, struct hym8563_txn *txn)
+{
+	unsigned long dirty = txn->dirty;
+	unsigned int val;
+	int reg, end, last, i, ret;
 
-		regs[0] = 0x0;
-		hym8563_i2c_set_regs(client, RTC_CTL2, regs, 1);
-		mon_day = rtc_month_days(tm->tm_mon, tm->tm_year + 1900);
-		hym8563_i2c_read_regs(client, RTC_A_MIN, regs, 4);
+	for (reg = 0; reg < HYM8563_REG_LEN; reg++) {
+		if (!(dirty & BIT(reg)) || !hym8563_reg_cached(hym8563, reg))
+			continue;
+		if (!hym8563_reg_read(hym8563, reg, &val) &&
+		    val == txn->regs[reg])
+			dirty &= ~BIT(reg);
+	}
 
-		if (tm->tm_min >= 60 || tm->tm_min < 0)		//set  min
-		regs[0x00] = bin2bcd(0x00) & 0x7f;
-		else
-		regs[0x00] = bin2bcd(tm->tm_min) & 0x7f;
-		if (tm->tm_hour >= 24 || tm->tm_hour < 0)	//set  hour
-		regs[0x01] = bin2bcd(0x00) & 0x7f;
-		else
-		regs[0x01] = bin2bcd(tm->tm_hour) & 0x7f;
-		regs[0x03] = bin2bcd (tm->tm_wday) & 0x7f;
-
-		/* if the input month day is bigger than the biggest day of this month, set the biggest day */
-		if (tm->tm_mday > mon_day)
-		regs[0x02] = bin2bcd(mon_day) & 0x7f;
-		else if (tm->tm_mday > 0)
-		regs[0x02] = bin2bcd(tm->tm_mday) & 0x7f;
-		else if (tm->tm_mday <= 0)
-		regs[0x02] = bin2bcd(0x01) & 0x7f;
-
-		hym8563_i2c_set_regs(client, RTC_A_MIN, regs, 4);	
-		hym8563_i2c_read_regs(client, RTC_A_MIN, regs, 4);	
-		hym8563_i2c_read_regs(client, RTC_CTL2, regs, 1);
-		if (alarm->enabled == 1)
-		regs[0] |= AIE;
-		else
-		regs[0] &= 0x0;
-		hym8563_i2c_set_regs(client, RTC_CTL2, regs, 1);
-		hym8563_i2c_read_regs(client, RTC_CTL2, regs, 1);
-		
-		printk("alarm regs[0]=0x%x\n",regs[0]);
-		
-		if(diff_sec <= 0)
-		{		
-			pr_info("alarm sec  <= now sec\n");
-		}			
+	for (reg = 0; reg < HYM8563_REG_LEN; reg = end) {
+		end = reg + 1;
+		if (reg == RTC_CTL2 || !(dirty & BIT(reg)))
+			continue;
+
+		for (last = reg; end < HYM8563_REG_LEN; end++) {
+			if (end == RTC_CTL2)
+				break;
+			if (dirty & BIT(end))
+				last = end;
+			else if (!hym8563_reg_cached(hym8563, end))
+				break;
+		}
+		end = last + 1;
+
+		for (i = reg; i < end; i++) {
+			if (dirty & BIT(i))
+				continue;
+			ret = hym8563_reg_read(hym8563, i, &val);
+			if (ret < 0)
+				return ret;
+			txn->regs[i] = val;
+		}
 
+		ret = hym8563_txn_write(hym8563, txn, reg, end - reg);
+		if (ret < 0)
+			return ret;
 	}
-	
-	mutex_unlock(&hym8563->mutex);
 
+	if (dirty & BIT(RTC_CTL2))
+		return hym8563_txn_write(hym8563, txn, RTC_CTL2, 1);
 	return 0;
 }
-#ifdef CONFIG_HDMI_SAVE_DATA
-int hdmi_get_data(void)
+
+/*
+ * Read the whole register file in one burst at probe. With the cache
+ * enabled regmap splits a raw read into single register reads, so it is
+ * bypassed for the burst and seeded from the result afterwards.
+ */
+static int hym8563_read_snapshot(struct hym8563 *hym8563, u8 *regs,
+				 ktime_t *stamp)
 {
-    u8 regs=0;
-    if(gClient)
-        hym8563_i2c_read_regs(gClient, RTC_T_COUNT, &regs, 1);
-    else 
-    {
-        printk("%s rtc has no init\n",__func__);
-        return -1;
-    }
-    if(regs==0 || regs==0xff){
-        printk("%s rtc has no hdmi data\n",__func__);
-        return -1;
-    }
-    return (regs-1);
+	struct regmap *map = hym8563->regmap;
+	int reg, ret;
+
+	regcache_cache_bypass(map, true);
+	*stamp = ktime_get();
+	ret = regmap_raw_read(map, RTC_CTL1, regs, HYM8563_REG_LEN);
+	regcache_cache_bypass(map, false);
+	if (ret < 0)
+		return ret;
+
+	/* cache-only writes fill the cache without touching the bus */
+	regcache_cache_only(map, true);
+	for (reg = 0; reg < HYM8563_REG_LEN; reg++)
+		if (!(HYM8563_VOLATILE_REGS & BIT(reg)))
+			regmap_write(map, reg, regs[reg]);
+	regcache_cache_only(map, false);
+	hym8563->regs_seen |= HYM8563_REG_RANGE(0, HYM8563_REG_LEN) &
+			      ~HYM8563_VOLATILE_REGS;
+	return 0;
 }
 
-int hdmi_set_data(int data)
+/* report what the alarm registers held before boot, AE set means unused */
+static void hym8563_recover_alarm(struct hym8563 *hym8563, const u8 *regs)
 {
-    u8 regs = (data+1)&0xff;
-    if(gClient)
-        hym8563_i2c_set_regs(gClient, RTC_T_COUNT, &regs, 1);
-    else 
-    {
-        printk("%s rtc has no init\n",__func__);
-        return -1;
-    }   
-    return 0;
+	struct rtc_time *tm = &hym8563->alarm.time;
+
+	tm->tm_sec = 0;
+	tm->tm_min = regs[RTC_A_MIN] & 0x80 ? -1 : bcd2bin(regs[RTC_A_MIN] & 0x7f);
+	tm->tm_hour = regs[RTC_A_HOUR] & 0x80 ? -1 : bcd2bin(regs[RTC_A_HOUR] & 0x3f);
+	tm->tm_mday = regs[RTC_A_DAY] & 0x80 ? -1 : bcd2bin(regs[RTC_A_DAY] & 0x3f);
+	tm->tm_wday = regs[RTC_A_WEEK] & 0x80 ? -1 : bcd2bin(regs[RTC_A_WEEK] & 0x07);
+	tm->tm_mon = -1;
+	tm->tm_year = -1;
+	tm->tm_yday = -1;
+	tm->tm_isdst = -1;
+	hym8563->alarm.pending = !!(regs[RTC_CTL2] & AF);
+
+	/* a running timer left a countdown there, not data */
+	hym8563->scratch = regs[RTC_T_CTL] & TE ? 0 : regs[RTC_T_COUNT];
 }
 
-EXPORT_SYMBOL(hdmi_get_data);
-EXPORT_SYMBOL(hdmi_set_data);
-#endif
-#if defined(CONFIG_RTC_INTF_DEV) || defined(CONFIG_RTC_INTF_DEV_MODULE)
-static int hym8563_i2c_open_alarm(struct i2c_client *client)
+/*
+ * Put the chip into the state the driver expects, starting from the probe
+ * snapshot: oscillator running, timer stopped and interrupts off with any
+ * stale AF/TF cleared. Registers already in that state are not written.
+ */
+static int hym8563_init_device(struct i2c_client *client, const u8 *regs)
 {
-	u8 data;	
-	hym8563_i2c_read_regs(client, RTC_CTL2, &data, 1);
-	data |= AIE;
-	hym8563_i2c_set_regs(client, RTC_CTL2, &data, 1);
+	struct hym8563 *hym8563 = i2c_get_clientdata(client);
+	struct hym8563_txn txn;
+	int sr;
 
-	return 0;
+	if (regs[RTC_CTL2] & (AF | TF))
+		dev_info(&client->dev, "%s flag set at boot\n",
+			 regs[RTC_CTL2] & AF ? "alarm" : "timer");
+
+	hym8563_txn_init(&txn);
+	hym8563_txn_stage(&txn, RTC_CTL1, 0);
+	/*
+	 * A PPS line owns the pin at 1 Hz. Otherwise a clk provider keeps
+	 * clkout off until prepared, else 32768 Hz runs.
+	 */
+	if (gpio_is_valid(hym8563->pps_gpio))
+		hym8563_txn_stage(&txn, HYM8563_CLKOUT,
+				  HYM8563_CLKOUT_ENABLE | HYM8563_CLKOUT_1);
+	else
+		hym8563_txn_stage(&txn, HYM8563_CLKOUT,
+				  IS_ENABLED(CONFIG_COMMON_CLK) ? 0 : HYM8563_CLKOUT_ENABLE);
+	hym8563_txn_stage(&txn, RTC_T_CTL, TD0 | TD1);
+	hym8563_txn_stage(&txn, RTC_CTL2, 0);
+
+	hym8563_lock(hym8563, HYM8563_OP_OTHER);
+	hym8563->ctl2 = 0;
+	sr = hym8563_txn_commit(hym8563, &txn);
+	hym8563_unlock(hym8563);
+	
+	return sr;
 }
 
-static int hym8563_i2c_close_alarm(struct i2c_client *client)
+/*
+ * The timer has stopped and T_COUNT is free again: put the scratch byte
+ * back in the same burst. Called with alarm_lock held.
+ */
+static void hym8563_scratch_release(struct hym8563 *hym8563,
+				    struct hym8563_txn *txn)
 {
-	u8 data;	
-	hym8563_i2c_read_regs(client, RTC_CTL2, &data, 1);
-	data &= ~AIE;
-	hym8563_i2c_set_regs(client, RTC_CTL2, &data, 1);
+	unsigned long flags;
 
-	return 0;
+	if (!hym8563->timer_owned)
+		return;
+	hym8563->timer_owned = false;
+
+	spin_lock_irqsave(&hym8563->cache_lock, flags);
+	hym8563_txn_stage(txn, RTC_T_COUNT, hym8563->scratch);
+	hym8563->scratch_dirty = false;
+	spin_unlock_irqrestore(&hym8563->cache_lock, flags);
 }
 
-static int hym8563_rtc_ioctl(struct device *dev, unsigned int cmd, unsigned long arg)
+/* write back a changed scratch byte, unless the timer holds T_COUNT */
+static int hym8563_scratch_flush(struct hym8563 *hym8563)
 {
-	struct i2c_client *client = to_i2c_client(dev);
+	unsigned long flags;
+	bool dirty;
+	int ret = 0;
+	u8 val;
 
-	switch (cmd) {
-	case RTC_AIE_OFF:
-		if(hym8563_i2c_close_alarm(client) < 0)
-			goto err;
-		break;
-	case RTC_AIE_ON:
-		if(hym8563_i2c_open_alarm(client))
-			goto err;
-		break;
-	default:
-		return -ENOIOCTLCMD;
-	}	
-	return 0;
-err:
-	return -EIO;
+	mutex_lock(&hym8563->alarm_lock);
+	spin_lock_irqsave(&hym8563->cache_lock, flags);
+	dirty = hym8563->scratch_dirty && !hym8563->timer_owned;
+	hym8563->scratch_dirty &= !dirty;
+	val = hym8563->scratch;
+	spin_unlock_irqrestore(&hym8563->cache_lock, flags);
+
+	if (dirty) {
+		hym8563_lock(hym8563, HYM8563_OP_OTHER);
+		ret = hym8563_i2c_set_regs(hym8563->client, RTC_T_COUNT, &val, 1);
+		hym8563_unlock(hym8563);
+		if (ret < 0) {
+			spin_lock_irqsave(&hym8563->cache_lock, flags);
+			hym8563->scratch_dirty = true;
+			spin_unlock_irqrestore(&hym8563->cache_lock, flags);
+		}
+	}
+	mutex_unlock(&hym8563->alarm_lock);
+
+	return ret < 0 ? ret : 0;
 }
-#else
-#define hym8563_rtc_ioctl NULL
-#endif
 
-#if defined(CONFIG_RTC_INTF_PROC) || defined(CONFIG_RTC_INTF_PROC_MODULE)
-static int hym8563_rtc_proc(struct device *dev, struct seq_file *seq)
+static void hym8563_scratch_work(struct work_struct *work)
 {
-	return 0;
+	struct hym8563 *hym8563 = container_of(work, struct hym8563, scratch_work);
+
+	if (hym8563_scratch_flush(hym8563))
+		dev_err(&hym8563->client->dev, "scratch write back failed\n");
 }
-#else
-#define hym8563_rtc_proc NULL
-#endif
 
-int xh_rtc_cancle_alarm(void)
+/* served from RAM, loaded from the probe snapshot */
+static u8 hym8563_scratch_read(struct hym8563 *hym8563)
 {
-	u8 value;
-	
-	printk("xh_rtc_cancle_alarm\n");
-	
-	//mutex_lock(&g_hym8563->mutex);
-	
-	hym8563_enable_count(gClient, 0);
-	hym8563_i2c_read_regs(gClient, RTC_CTL2, &value, 1);
-	value &= ~(AF|TF);
-	value &= 0x0;
-	hym8563_i2c_set_regs(gClient, RTC_CTL2, &value, 1);
-	hym8563_i2c_read_regs(gClient, RTC_CTL2, &value, 1);
-	//printk("alarm value=0x%x\n",value);
-	
-	//mutex_unlock(&g_hym8563->mutex);
-		
-	return 0;
-}EXPORT_SYMBOL(xh_rtc_cancle_alarm);
+	unsigned long flags;
+	u8 val;
 
-static int hym8563_rtc_alarm_irq_enable(struct device *dev,
-				       unsigned int enabled)
+	spin_lock_irqsave(&hym8563->cache_lock, flags);
+	val = hym8563->scratch;
+	spin_unlock_irqrestore(&hym8563->cache_lock, flags);
+
+	return val;
+}
+
+static int hym8563_scratch_write(struct hym8563 *hym8563, u8 val)
 {
+	unsigned long flags;
+	bool changed;
+
+	spin_lock_irqsave(&hym8563->cache_lock, flags);
+	changed = hym8563->scratch != val;
+	hym8563->scratch = val;
+	hym8563->scratch_dirty |= changed;
+	spin_unlock_irqrestore(&hym8563->cache_lock, flags);
+
+	if (!changed)
+		return 0;
+	if (defer_scratch) {
+		schedule_work(&hym8563->scratch_work);
 		return 0;
+	}
+	return hym8563_scratch_flush(hym8563);
 }
-static irqreturn_t hym8563_wakeup_irq(int irq, void *data)
+
+static void hym8563_regs_to_tm(const u8 *regs, struct rtc_time *tm)
 {
-	struct hym8563 *hym8563 = data;	
-	struct i2c_client *client = hym8563->client;	
-	u8 value;
-	
-	mutex_lock(&hym8563->mutex);
+	tm->tm_sec = bcd2bin(regs[0x00] & 0x7F);
+	tm->tm_min = bcd2bin(regs[0x01] & 0x7F);
+	tm->tm_hour = bcd2bin(regs[0x02] & 0x3F);
+	tm->tm_mday = bcd2bin(regs[0x03] & 0x3F);
+	tm->tm_wday = bcd2bin(regs[0x04] & 0x07);	
 	
-	hym8563_enable_count(client, 0);
+	tm->tm_mon = bcd2bin(regs[0x05] & 0x1F) ; 
+	tm->tm_mon -= 1;			//inorder to cooperate the systerm time
 	
-	hym8563_i2c_read_regs(client, RTC_CTL2, &value, 1);
-	value &= ~(AF|TF);
-	hym8563_i2c_set_regs(client, RTC_CTL2, &value, 1);	
-	mutex_unlock(&hym8563->mutex);
+	tm->tm_year = bcd2bin(regs[0x06] & 0xFF);
+	if(regs[5] & 0x80)
+		tm->tm_year += 1900;
+	else
+		tm->tm_year += 2000;
+		
+	tm->tm_yday = rtc_year_days(tm->tm_mday, tm->tm_mon, tm->tm_year);	
 	
-	rtc_update_irq(hym8563->rtc, 1, RTC_IRQF | RTC_AF | RTC_UF);
+	tm->tm_year -= 1900;			//inorder to cooperate the systerm time	
+	if(tm->tm_year < 0)
+		tm->tm_year = 0;	
+	tm->tm_isdst = 0;	
+}
 
-	printk("%s:irq=%d\n",__func__,irq);
-	return IRQ_HANDLED;
+static bool hym8563_phase_predict(struct hym8563 *hym8563, ktime_t now,
+				  s64 *raw_ns);
+
+/* a read latched right at an edge may report either second */
+#define HYM8563_PHASE_SLACK_NS	(20 * NSEC_PER_MSEC)
+/* how often a cache without an edge may poll for one */
+#define HYM8563_PHASE_RETRY_MS	(60 * MSEC_PER_SEC)
+/* a running 1 Hz tick renews the edge every second, allow one miss */
+#define HYM8563_TICK_CACHE_MS	(2 * MSEC_PER_SEC)
+
+/*
+ * The registers only change once per second, so reads can be served from
+ * a known seconds edge, see hym8563_phase_sync(), by extrapolation. A
+ * sample of unknown phase is no anchor: it may have been taken late in
+ * its second and would trail the chip by up to a second. So the cache
+ * only serves while an edge is known and the last bus read, no more than
+ * cache_interval_ms ago, agreed with it, and not close enough to the
+ * next edge for the chip to be there already. Without an edge one is
+ * looked for in the background. While the 1 Hz tick runs, each tick is
+ * an edge, see hym8563_tick_phase(), and the cache serves from it even
+ * when cache_interval_ms is 0.
+ */
+static bool hym8563_cache_read(struct hym8563 *hym8563, unsigned long *sec)
+{
+	unsigned int interval = hym8563->cache_interval_ms;
+	ktime_t now = ktime_get();
+	unsigned long flags;
+	s64 elapsed, raw_ns;
+	s32 rem;
+	bool hit = false, confirmed, sync = false;
+
+	if (ACCESS_ONCE(hym8563->tick_running))
+		interval = max_t(unsigned int, interval, HYM8563_TICK_CACHE_MS);
+	if (!interval)
+		return false;
+
+	spin_lock_irqsave(&hym8563->cache_lock, flags);
+	elapsed = ktime_ms_delta(now, hym8563->cache_stamp);
+	confirmed = hym8563->cache_valid && elapsed >= 0 && elapsed < interval;
+	if (hym8563->cache_interval_ms && !hym8563->phase_valid &&
+	    ktime_after(now, hym8563->phase_retry)) {
+		hym8563->phase_retry = ktime_add_ms(now, HYM8563_PHASE_RETRY_MS);
+		sync = true;
+	}
+	spin_unlock_irqrestore(&hym8563->cache_lock, flags);
+
+	if (confirmed && hym8563_phase_predict(hym8563, now, &raw_ns)) {
+		*sec = div_s64_rem(raw_ns, NSEC_PER_SEC, &rem);
+		hit = rem >= HYM8563_PHASE_SLACK_NS &&
+		      rem < NSEC_PER_SEC - HYM8563_PHASE_SLACK_NS;
+	}
+
+	spin_lock_irqsave(&hym8563->cache_lock, flags);
+	if (hit)
+		hym8563->cache_hits++;
+	else
+		hym8563->cache_misses++;
+	spin_unlock_irqrestore(&hym8563->cache_lock, flags);
+
+	if (sync)
+		schedule_work(&hym8563->phase_work);
+	return hit;
 }
-#ifdef CONFIG_COMMON_CLK
-#define clkout_hw_to_hym8563(_hw) container_of(_hw, struct hym8563, clkout_hw)
 
-static int clkout_rates[] = {
-	32768,
-	1024,
-	32,
-	1,
-};
+/* publish a hardware sample to the mmap()able page, cache_lock held */
+static void hym8563_snapshot_update(struct hym8563 *hym8563, u32 flags,
+				    unsigned long sec, ktime_t stamp)
+{
+	struct xhrtc_snapshot *snap = hym8563->snapshot;
+
+	if (!snap)
+		return;
+
+	snap->seq++;
+	smp_wmb();
+	if (flags & XHRTC_SNAPSHOT_VALID) {
+		snap->rtc_sec = sec;
+		snap->mono_ns = ktime_to_ns(stamp);
+	}
+	snap->flags = flags;
+	smp_wmb();
+	snap->seq++;
+}
+
+/* check a bus sample against the known edge, which it renews or drops */
+static void hym8563_cache_update(struct hym8563 *hym8563, const u8 *regs,
+				 struct rtc_time *tm, ktime_t stamp)
+{
+	unsigned long flags, sec = 0;
+	s64 raw_ns;
+	bool valid, agree;
+
+	/* never anchor to a value the chip itself flags as unreliable */
+	valid = !(regs[0] & HYM8563_SEC_VL) && rtc_valid_tm(tm) == 0;
+	if (valid)
+		rtc_tm_to_time(tm, &sec);
+	agree = valid && hym8563_phase_predict(hym8563, stamp, &raw_ns) &&
+		raw_ns > (s64)sec * NSEC_PER_SEC - HYM8563_PHASE_SLACK_NS &&
+		raw_ns < (s64)(sec + 1) * NSEC_PER_SEC + HYM8563_PHASE_SLACK_NS;
+
+	spin_lock_irqsave(&hym8563->cache_lock, flags);
+	hym8563->cache_valid = agree;
+	if (agree)
+		hym8563->cache_stamp = stamp;
+	else
+		hym8563->phase_valid = false;
+	if (valid) {
+		hym8563->good_sec = sec;
+		hym8563->good_stamp = stamp;
+	}
+	hym8563->good_valid = valid;
+	/* a known edge is a better anchor than a sample of unknown phase */
+	if (!hym8563->phase_valid)
+		hym8563_snapshot_update(hym8563,
+					valid ? XHRTC_SNAPSHOT_VALID : 0,
+					sec, stamp);
+	spin_unlock_irqrestore(&hym8563->cache_lock, flags);
+}
+
+/*
+ * Time for a reader while the bus is failing: the last value read from or
+ * written to the chip, advanced by CLOCK_MONOTONIC, instead of blocking on
+ * the bus or failing.
+ */
+static bool hym8563_fallback_read(struct hym8563 *hym8563, unsigned long *sec)
+{
+	unsigned long flags;
+	bool ok;
+
+	spin_lock_irqsave(&hym8563->cache_lock, flags);
+	ok = hym8563->good_valid;
+	if (ok) {
+		*sec = hym8563->good_sec + div_s64(ktime_ms_delta(ktime_get(),
+					hym8563->good_stamp), MSEC_PER_SEC);
+		hym8563->fallback_reads++;
+	}
+	spin_unlock_irqrestore(&hym8563->cache_lock, flags);
+
+	return ok;
+}
+
+static void hym8563_cache_invalidate(struct hym8563 *hym8563)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&hym8563->cache_lock, flags);
+	hym8563->cache_valid = false;
+	spin_unlock_irqrestore(&hym8563->cache_lock, flags);
+}
+
+/*
+ * CLOCK_MONOTONIC stops in suspend while the chip keeps counting, so
+ * nothing anchored to it may outlive it: not the cache, the fallback,
+ * the known edge or the mmap()ed snapshot. The rtc core reads the time
+ * on resume to inject the sleep time and must see the chip.
+ */
+static void hym8563_cache_drop(struct hym8563 *hym8563)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&hym8563->cache_lock, flags);
+	hym8563->cache_valid = false;
+	hym8563->good_valid = false;
+	hym8563->phase_valid = false;
+	hym8563_snapshot_update(hym8563, 0, 0, ktime_set(0, 0));
+	spin_unlock_irqrestore(&hym8563->cache_lock, flags);
+}
+
+/*
+ * Crystal drift is estimated the way hwclock does it: an rtc class
+ * set_time is taken as the true time, so the RTC error it corrects,
+ * over the time since the previous set_time, is the crystal's rate
+ * error. drift_anchor is the RTC time in seconds of that previous
+ * set_time, where chip and true time agreed; 0 means none. Userspace can
+ * save both values through sysfs and restore them after a reboot.
+ */
+#define HYM8563_DRIFT_MAX_PPB	500000
+/* seconds resolution, so a day bounds the error to about 12 ppm */
+#define HYM8563_DRIFT_MIN_SPAN	(24 * 3600)
+
+static void hym8563_drift_set(struct hym8563 *hym8563, s32 ppb, s64 anchor)
+{
+	struct xhrtc_snapshot *snap = hym8563->snapshot;
+	unsigned long flags;
+
+	spin_lock_irqsave(&hym8563->cache_lock, flags);
+	hym8563->drift_ppb = ppb;
+	hym8563->drift_anchor = anchor;
+	if (snap) {
+		snap->seq++;
+		smp_wmb();
+		snap->drift_ppb = ppb;
+		smp_wmb();
+		snap->seq++;
+	}
+	spin_unlock_irqrestore(&hym8563->cache_lock, flags);
+}
+
+static void hym8563_drift_get(struct hym8563 *hym8563, s32 *ppb, s64 *anchor)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&hym8563->cache_lock, flags);
+	*ppb = hym8563->drift_ppb;
+	*anchor = hym8563->drift_anchor;
+	spin_unlock_irqrestore(&hym8563->cache_lock, flags);
+}
+
+/* first order: how far the chip has run ahead of true time at @ns */
+static s64 hym8563_drift_offset(struct hym8563 *hym8563, s64 ns)
+{
+	s64 anchor;
+	s32 ppb;
+
+	hym8563_drift_get(hym8563, &ppb, &anchor);
+	if (!anchor || !ppb)
+		return 0;
+	/* ms * ppb / 1000 is ns; in ms so a year times ppb stays within s64 */
+	return div_s64(div_s64(ns - anchor * NSEC_PER_SEC, NSEC_PER_MSEC) * ppb,
+		       MSEC_PER_SEC);
+}
+
+static s64 hym8563_raw_to_true(struct hym8563 *hym8563, s64 raw_ns)
+{
+	return raw_ns - hym8563_drift_offset(hym8563, raw_ns);
+}
+
+static s64 hym8563_true_to_raw(struct hym8563 *hym8563, s64 true_ns)
+{
+	return true_ns + hym8563_drift_offset(hym8563, true_ns);
+}
+
+static int hym8563_read_datetime(struct i2c_client *client, struct rtc_time *tm,
+				 enum hym8563_op op)
+{
+	struct hym8563 *hym8563 = i2c_get_clientdata(client);
+	u8 regs[HYM8563_RTC_SECTION_LEN] = { 0, };
+	unsigned long sec;
+	ktime_t stamp;
+	int ret;
+
+	/* only read_time is served from the edge, everyone else checks the chip */
+	if (op == HYM8563_OP_READ_TIME && hym8563_cache_read(hym8563, &sec)) {
+		rtc_time_to_tm(sec, tm);
+		return 0;
+	}
+
+	hym8563_lock(hym8563, op);
+//	for (i = 0; i < HYM8563_RTC_SECTION_LEN; i++) {
+//		hym8563_i2c_read_regs(client, RTC_SEC+i, &regs[i], 1);
+//	}
+	/* the chip latches the time registers when the read starts */
+	stamp = ktime_get();
+	ret = hym8563_i2c_read_regs(client, RTC_SEC, regs, HYM8563_RTC_SECTION_LEN);
+
+	hym8563_unlock(hym8563);
+
+	if (ret < 0) {
+		/* drift is measured against this read, a guess would skew it */
+		if (op == HYM8563_OP_SET_TIME || !hym8563_fallback_read(hym8563, &sec))
+			return ret;
+		dev_warn_ratelimited(&client->dev, "read failed (%d), using last known time\n", ret);
+		rtc_time_to_tm(sec, tm);
+		return 0;
+	}
+	
+	hym8563_regs_to_tm(regs, tm);
+	hym8563_cache_update(hym8563, regs, tm, stamp);
+
+	pr_debug("%4d-%02d-%02d(%d) %02d:%02d:%02d\n",
+		1900 + tm->tm_year, tm->tm_mon + 1, tm->tm_mday, tm->tm_wday,
+		tm->tm_hour, tm->tm_min, tm->tm_sec);
+
+	return 0;
+}
+
+/*
+ * Precise mode. The time registers only say which second it is, so
+ * sub-second time needs to know when that second began. An edge found by
+ * hym8563_phase_sync(), or made by a precise set_time, is extrapolated at
+ * the crystal's rate and checked against the chip on every read.
+ */
+#define HYM8563_PHASE_TTL_MS	(10 * 60 * MSEC_PER_SEC)
+/* long enough to see two edges, in case the bus was busy over the first */
+#define HYM8563_PHASE_POLL_MS	2100
+/* polls further apart than this do not pin the edge down */
+#define HYM8563_PHASE_GAP_NS	(3 * NSEC_PER_MSEC)
+
+static void hym8563_phase_set(struct hym8563 *hym8563, bool valid,
+			      unsigned long sec, ktime_t stamp)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&hym8563->cache_lock, flags);
+	hym8563->phase_valid = valid;
+	if (valid) {
+		hym8563->phase_sec = sec;
+		hym8563->phase_stamp = stamp;
+		hym8563->cache_stamp = stamp;
+		hym8563->cache_valid = true;
+		hym8563->good_valid = true;
+		hym8563->good_sec = sec;
+		hym8563->good_stamp = stamp;
+	}
+	hym8563_snapshot_update(hym8563, valid ?
+				XHRTC_SNAPSHOT_VALID | XHRTC_SNAPSHOT_EDGE : 0,
+				sec, stamp);
+	spin_unlock_irqrestore(&hym8563->cache_lock, flags);
+}
+
+/* raw chip time in ns at @now, extrapolated from the known edge */
+static bool hym8563_phase_predict(struct hym8563 *hym8563, ktime_t now,
+				  s64 *raw_ns)
+{
+	unsigned long flags;
+	s64 elapsed;
+	bool ok = false;
+
+	spin_lock_irqsave(&hym8563->cache_lock, flags);
+	elapsed = ktime_to_ns(ktime_sub(now, hym8563->phase_stamp));
+	if (hym8563->phase_valid && elapsed >= 0 &&
+	    elapsed < (s64)HYM8563_PHASE_TTL_MS * NSEC_PER_MSEC) {
+		/* the crystal runs drift_ppb fast against CLOCK_MONOTONIC */
+		elapsed += div_s64(div_s64(elapsed, NSEC_PER_MSEC) *
+				   hym8563->drift_ppb, MSEC_PER_SEC);
+		*raw_ns = (s64)hym8563->phase_sec * NSEC_PER_SEC + elapsed;
+		ok = true;
+	}
+	spin_unlock_irqrestore(&hym8563->cache_lock, flags);
+
+	return ok;
+}
+
+static int hym8563_read_raw(struct hym8563 *hym8563, enum hym8563_op op,
+			    unsigned long *sec, ktime_t *stamp)
+{
+	u8 regs[HYM8563_RTC_SECTION_LEN];
+	struct rtc_time tm;
+	int ret;
+
+	hym8563_lock(hym8563, op);
+	*stamp = ktime_get();
+	ret = hym8563_i2c_read_regs(hym8563->client, RTC_SEC, regs,
+				    HYM8563_RTC_SECTION_LEN);
+	hym8563_unlock(hym8563);
+	if (ret < 0)
+		return ret;
+
+	hym8563_regs_to_tm(regs, &tm);
+	if ((regs[0] & HYM8563_SEC_VL) || rtc_valid_tm(&tm))
+		return -EINVAL;
+	rtc_tm_to_time(&tm, sec);
+	return 0;
+}
+
+/*
+ * Poll the time registers until the second changes. The chip latches them
+ * when a read starts, so the edge lies between the starts of the last read
+ * that saw the old second and the first that saw the new one.
+ */
+static int hym8563_phase_sync(struct hym8563 *hym8563, enum hym8563_op op)
+{
+	unsigned long sec, first = 0;
+	ktime_t start, prev = ktime_set(0, 0), deadline;
+	bool seen = false;
+	int ret;
+
+	deadline = ktime_add_ms(ktime_get(), HYM8563_PHASE_POLL_MS);
+	for (;;) {
+		ret = hym8563_read_raw(hym8563, op, &sec, &start);
+		if (ret)
+			break;
+		if (seen && sec != first &&
+		    ktime_to_ns(ktime_sub(start, prev)) <= HYM8563_PHASE_GAP_NS)
+			break;
+		if (ktime_after(start, deadline)) {
+			ret = -ETIMEDOUT;
+			break;
+		}
+		seen = true;
+		first = sec;
+		prev = start;
+		usleep_range(500, 1000);
+	}
+
+	if (ret) {
+		hym8563_phase_set(hym8563, false, 0, start);
+		return ret;
+	}
+	hym8563_phase_set(hym8563, true, sec,
+			  ktime_add_ns(prev, ktime_to_ns(ktime_sub(start, prev)) >> 1));
+	return 0;
+}
+
+/* an edge for the time cache, see hym8563_cache_read() */
+static void hym8563_phase_work(struct work_struct *work)
+{
+	struct hym8563 *hym8563 = container_of(work, struct hym8563, phase_work);
+	int ret;
+
+	ret = hym8563_phase_sync(hym8563, HYM8563_OP_READ_TIME);
+	if (ret)
+		dev_dbg(&hym8563->client->dev, "no seconds edge (%d)\n", ret);
+}
+
+/* drift corrected time in ns, resyncing to an edge when there is none */
+static int hym8563_read_precise(struct hym8563 *hym8563, enum hym8563_op op,
+				s64 *true_ns)
+{
+	unsigned long sec;
+	ktime_t stamp;
+	s64 raw_ns;
+	int ret, tries;
+
+	for (tries = 0; tries < 2; tries++) {
+		ret = hym8563_read_raw(hym8563, op, &sec, &stamp);
+		if (ret) {
+			hym8563_phase_set(hym8563, false, 0, stamp);
+			return ret;
+		}
+		/* the chip must still be inside the predicted second */
+		if (hym8563_phase_predict(hym8563, stamp, &raw_ns) &&
+		    raw_ns > (s64)sec * NSEC_PER_SEC - HYM8563_PHASE_SLACK_NS &&
+		    raw_ns < (s64)(sec + 1) * NSEC_PER_SEC + HYM8563_PHASE_SLACK_NS &&
+		    hym8563_phase_predict(hym8563, ktime_get(), &raw_ns)) {
+			*true_ns = hym8563_raw_to_true(hym8563, raw_ns);
+			return 0;
+		}
+
+		dev_dbg(&hym8563->client->dev, "seconds edge unknown, polling\n");
+		ret = hym8563_phase_sync(hym8563, op);
+		if (ret)
+			return ret;
+	}
+	return -EIO;
+}
+
+static int hym8563_rtc_read_time(struct device *dev, struct rtc_time *tm)
+{
+	struct i2c_client *client = to_i2c_client(dev);
+	struct hym8563 *hym8563 = i2c_get_clientdata(client);
+	ktime_t start = ktime_get();
+	unsigned long sec;
+	s64 ns;
+	int ret;
+
+	if (hym8563->precise_time) {
+		ret = hym8563_read_precise(hym8563, HYM8563_OP_READ_TIME, &ns);
+		if (!ret)
+			rtc_time_to_tm(div_s64(ns, NSEC_PER_SEC), tm);
+		else if (ret != -EINVAL && hym8563_fallback_read(hym8563, &sec)) {
+			rtc_time_to_tm(sec, tm);
+			ret = 0;
+		}
+		return hym8563_op_end(hym8563, HYM8563_OP_READ_TIME, start, ret);
+	}
+
+	ret = hym8563_read_datetime(client, tm, HYM8563_OP_READ_TIME);
+	if (!ret && hym8563->drift_ppb && rtc_valid_tm(tm) == 0) {
+		rtc_tm_to_time(tm, &sec);
+		rtc_time_to_tm(div_s64(hym8563_raw_to_true(hym8563,
+				(s64)sec * NSEC_PER_SEC), NSEC_PER_SEC), tm);
+	}
+	return hym8563_op_end(hym8563, HYM8563_OP_READ_TIME, start, ret);
+}
+
+static int hym8563_set_time(struct i2c_client *client, struct rtc_time *tm)	
+{
+	struct hym8563 *hym8563 = i2c_get_clientdata(client);
+	u8 regs[HYM8563_RTC_SECTION_LEN] = { 0, };
+	unsigned long sec = 0, flags;
+	ktime_t start;
+	bool valid;
+	u8 mon_day;
+	int ret;
+
+	pr_debug("%4d-%02d-%02d(%d) %02d:%02d:%02d\n",
+		1900 + tm->tm_year, tm->tm_mon + 1, tm->tm_mday, tm->tm_wday,
+		tm->tm_hour, tm->tm_min, tm->tm_sec);
+
+	mon_day = rtc_month_days((tm->tm_mon), tm->tm_year + 1900);
+	
+	if(tm->tm_sec >= 60 || tm->tm_sec < 0 )		//set  sec
+		regs[0x00] = bin2bcd(0x00);
+	else
+		regs[0x00] = bin2bcd(tm->tm_sec);
+	
+	if(tm->tm_min >= 60 || tm->tm_min < 0 )		//set  min	
+		regs[0x01] = bin2bcd(0x00);
+	else
+		regs[0x01] = bin2bcd(tm->tm_min);
+
+	if(tm->tm_hour >= 24 || tm->tm_hour < 0 )		//set  hour
+		regs[0x02] = bin2bcd(0x00);
+	else
+		regs[0x02] = bin2bcd(tm->tm_hour);
+	
+	if((tm->tm_mday) > mon_day)				//if the input month day is bigger than the biggest day of this month, set the biggest day 
+		regs[0x03] = bin2bcd(mon_day);
+	else if((tm->tm_mday) > 0)
+		regs[0x03] = bin2bcd(tm->tm_mday);
+	else if((tm->tm_mday) <= 0)
+		regs[0x03] = bin2bcd(0x01);
+
+	if( tm->tm_year >= 200)		// year >= 2100
+		regs[0x06] = bin2bcd(99);	//year = 2099
+	else if(tm->tm_year >= 100)			// 2000 <= year < 2100
+		regs[0x06] = bin2bcd(tm->tm_year - 100);
+	else if(tm->tm_year >= 0){				// 1900 <= year < 2000
+		regs[0x06] = bin2bcd(tm->tm_year);	
+		regs[0x05] |= 0x80;	
+	}else{									// year < 1900
+		regs[0x06] = bin2bcd(0);	//year = 1900	
+		regs[0x05] |= 0x80;	
+	}	
+	regs[0x04] = bin2bcd(tm->tm_wday);		//set  the  weekday
+	regs[0x05] = (regs[0x05] & 0x80)| (bin2bcd(tm->tm_mon + 1) & 0x7F);		//set  the  month
+	
+	hym8563_lock(hym8563, HYM8563_OP_SET_TIME);
+//	for(i=0;i<HYM8563_RTC_SECTION_LEN;i++){
+//		ret = hym8563_i2c_set_regs(client, RTC_SEC+i, &regs[i], 1);
+//	}
+	start = ktime_get();
+	ret = hym8563_i2c_set_regs(client, RTC_SEC, regs, HYM8563_RTC_SECTION_LEN);
+	hym8563->time_write_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	hym8563_cache_invalidate(hym8563);
+
+	hym8563_unlock(hym8563);
+
+	valid = ret >= 0 && rtc_valid_tm(tm) == 0;
+	if (valid)
+		rtc_tm_to_time(tm, &sec);
+	start = ktime_add_ns(start, hym8563->time_write_ns >> 1);
+	spin_lock_irqsave(&hym8563->cache_lock, flags);
+	hym8563->good_valid = valid;
+	hym8563->good_sec = sec;
+	hym8563->good_stamp = start;
+	spin_unlock_irqrestore(&hym8563->cache_lock, flags);
+
+	/* the write restarted the seconds divider, see hym8563_set_time_precise() */
+	hym8563_phase_set(hym8563, valid && hym8563->precise_time, sec, start);
+
+	return ret < 0 ? ret : 0;
+}
+
+/*
+ * Like the PCF8563, the chip restarts its seconds divider when the time
+ * registers are written, so the write itself becomes a seconds edge.
+ * Line that edge up with CLOCK_REALTIME: sleep until the next full second,
+ * less half a burst for the bytes ahead of the seconds register, and
+ * write that second. A caller setting some other time keeps its offset.
+ */
+#define HYM8563_SET_MIN_WAIT_NS	(2 * NSEC_PER_MSEC)
+
+static int hym8563_set_time_precise(struct hym8563 *hym8563,
+				    struct rtc_time *tm, unsigned long *written)
+{
+	struct rtc_time at;
+	unsigned long sec;
+	s64 real, target, lead, delta, wait_us;
+
+	rtc_tm_to_time(tm, &sec);
+	real = ktime_to_ns(ktime_get_real());
+	delta = (s64)sec - div_s64(real, NSEC_PER_SEC);
+	/* systohc rounds to the nearest second, either way it means now */
+	if (delta >= -1 && delta <= 1)
+		delta = 0;
+
+	lead = hym8563->time_write_ns >> 1;
+	target = (div_s64(real, NSEC_PER_SEC) + 1) * NSEC_PER_SEC;
+	if (target - lead - real < HYM8563_SET_MIN_WAIT_NS)
+		target += NSEC_PER_SEC;
+
+	wait_us = div_s64(target - lead - ktime_to_ns(ktime_get_real()),
+			  NSEC_PER_USEC);
+	if (wait_us > 0)
+		usleep_range(wait_us, wait_us + 50);
+
+	*written = div_s64(target, NSEC_PER_SEC) + delta;
+	rtc_time_to_tm(*written, &at);
+	return hym8563_set_time(hym8563->client, &at);
+}
+
+/*
+ * Called right before @true_sec is written: compare it with what the chip
+ * counted since the last anchor and refresh the estimate when that span
+ * is long enough to resolve it.
+ */
+static void hym8563_drift_measure(struct hym8563 *hym8563, unsigned long true_sec)
+{
+	struct rtc_time now;
+	unsigned long raw_sec;
+	s64 anchor, span, ppb;
+	s32 old_ppb;
+
+	hym8563_drift_get(hym8563, &old_ppb, &anchor);
+	if (!anchor)
+		return;
+	span = (s64)true_sec - anchor;
+	if (span < HYM8563_DRIFT_MIN_SPAN)
+		return;
+
+	if (hym8563_read_datetime(hym8563->client, &now, HYM8563_OP_SET_TIME) ||
+	    rtc_valid_tm(&now))
+		return;
+	rtc_tm_to_time(&now, &raw_sec);
+
+	ppb = div_s64(((s64)raw_sec - (s64)true_sec) * NSEC_PER_SEC, span);
+	if (abs(ppb) > HYM8563_DRIFT_MAX_PPB) {
+		dev_dbg(&hym8563->client->dev, "ignoring drift of %lld ppb\n", ppb);
+		return;
+	}
+	dev_dbg(&hym8563->client->dev, "drift %lld ppb over %lld s\n", ppb, span);
+	hym8563_drift_set(hym8563, ppb, anchor);
+}
+
+/*
+ * Countdown timer sources, fastest first. A source ticks on a fixed grid
+ * derived from the seconds divider, so n ticks of the 1 Hz source end
+ * exactly on a seconds edge and the faster sources land on a sub-second
+ * grid point once the phase of the current second is known.
+ */
+struct hym8563_timer_src {
+	u8	td;
+	u32	hz;
+};
+
+static const struct hym8563_timer_src hym8563_fast_srcs[] = {
+	{ 0,	4096 },
+	{ TD0,	64 },
+};
+
+#define HYM8563_TD_1HZ		TD1
+#define HYM8563_TD_1_60HZ	(TD0 | TD1)
+#define HYM8563_T_COUNT_MAX	255
+/* longest countdown the 64 Hz source can express */
+#define HYM8563_FAST_RANGE_NS	((s64)HYM8563_T_COUNT_MAX * (NSEC_PER_SEC / 64))
+
+static void hym8563_stage_alarm(struct hym8563_txn *txn, unsigned long sec)
+{
+	struct rtc_time tm;
+
+	rtc_time_to_tm(sec, &tm);
+	hym8563_txn_stage(txn, RTC_A_MIN, bin2bcd(tm.tm_min) & 0x7f);
+	hym8563_txn_stage(txn, RTC_A_HOUR, bin2bcd(tm.tm_hour) & 0x7f);
+	hym8563_txn_stage(txn, RTC_A_DAY, bin2bcd(tm.tm_mday) & 0x7f);
+	hym8563_txn_stage(txn, RTC_A_WEEK, bin2bcd(tm.tm_wday) & 0x7f);
+}
+
+/*
+ * Record @st as the stage the chip now holds, or none if the commit
+ * failed and the chip state is unknown. Called with the mutex held right
+ * after the commit, see hym8563_wakeup_irq().
+ */
+static void hym8563_stage_arm(struct hym8563 *hym8563,
+			      const struct hym8563_stage *st, int ret)
+{
+	hym8563->stage = *st;
+	hym8563->stage.armed_at = ktime_get();
+	hym8563->stage_live = !ret;
+}
+
+/*
+ * Arm the chip for the next stage towards @expires (RTC time in ns).
+ * Stages are chained from the interrupt handler until it is reached,
+ * and only the last one may end after it, by less than one 4096 Hz tick
+ * (244 us):
+ *
+ *  - sub-second remainders use the 4096 Hz or 64 Hz source, which needs
+ *    the phase of the current second (known right after an edge); with
+ *    the phase unknown hym8563_alarm_rearm() has already expired anything
+ *    due in the current second. The 64 Hz source stops short of the
+ *    deadline and the 4096 Hz one ends on the first tick at or after it
+ *  - up to 255 s the 1 Hz source runs to the deadline's seconds edge
+ *  - up to 255 min the 1/60 Hz source gets within two minutes of it
+ *  - beyond that the minute alarm fires on the deadline's minute
+ *
+ * The chosen stage and its register changes are committed as one
+ * transaction. Must be called with the alarm lock held.
+ */
+static int hym8563_program_alarm(struct hym8563 *hym8563, ktime_t expires,
+				 s64 now_ns, bool phase_known, enum hym8563_op op)
+{	
+	struct hym8563_stage st = { .exact = true };
+	struct hym8563_txn txn;
+	s64 dl_ns, now_sec, dl_sec, delta_sec;
+	u64 off_dl, off_now, k_dl, k_now;
+	u32 count = 0;
+	s32 rem;
+	u8 td = 0, ctl2;
+	int i, ret;
+
+	/* the queue keeps true time, the chip counts in its own */
+	dl_ns = hym8563_true_to_raw(hym8563, ktime_to_ns(expires));
+	now_ns = hym8563_true_to_raw(hym8563, now_ns);
+	now_sec = div_s64(now_ns, NSEC_PER_SEC);
+	dl_sec = div_s64(dl_ns, NSEC_PER_SEC);
+	delta_sec = dl_sec - now_sec;
+
+	hym8563_txn_init(&txn);
+
+	/* the queue is polled from the ticks instead, see hym8563_pie_tick() */
+	if (hym8563->pie_hz)
+		return 0;
+
+	/*
+	 * A 1 Hz tick left running by the last stage fires on every second
+	 * edge, which is all a deadline one edge ahead needs. The rtc core
+	 * asks for exactly that each second while update interrupts are on.
+	 */
+	if (hym8563->tick_running && delta_sec == 1 &&
+	    dl_ns == dl_sec * NSEC_PER_SEC) {
+		st.target = hym8563_raw_to_true(hym8563, dl_ns);
+		st.src = XHRTC_EVENT_TIMER;
+		ret = 0;
+		hym8563_lock(hym8563, op);
+		if (hym8563->ctl2 != TIE) {
+			/* any tick taken while masked is in the past */
+			hym8563->ctl2 = TIE;
+			ret = hym8563_write_ctl2(hym8563, true);
+			hym8563->program_commits++;
+		}
+		hym8563_stage_arm(hym8563, &st, ret);
+		hym8563_unlock(hym8563);
+		return ret;
+	}
+
+	/* whole seconds are exact on the 1 Hz source and cost fewer ticks */
+	if (delta_sec <= 0 ||
+	    (phase_known && dl_ns - now_ns < HYM8563_FAST_RANGE_NS &&
+	     dl_ns != dl_sec * NSEC_PER_SEC)) {
+		/*
+		 * Ticks are counted on a grid anchored at now_sec. Without the
+		 * phase we may be anywhere in the second, possibly past the
+		 * deadline already, so take the shortest count there is.
+		 */
+		off_dl = max_t(s64, dl_ns - now_sec * NSEC_PER_SEC, 0);
+		off_now = phase_known ? now_ns - now_sec * NSEC_PER_SEC : off_dl;
+		for (i = 0; i < ARRAY_SIZE(hym8563_fast_srcs); i++) {
+			td = hym8563_fast_srcs[i].td;
+			/* only the finest source may round past the deadline */
+			k_dl = div_u64(off_dl * hym8563_fast_srcs[i].hz +
+				       (i ? 0 : NSEC_PER_SEC - 1), NSEC_PER_SEC);
+			k_now = div_u64(off_now * hym8563_fast_srcs[i].hz,
+					NSEC_PER_SEC);
+			count = k_dl > k_now ? k_dl - k_now : 1;
+			if (count <= HYM8563_T_COUNT_MAX)
+				break;
+		}
+		if (i == ARRAY_SIZE(hym8563_fast_srcs)) {
+			/* too far even for 64 Hz, chain another stage */
+			i--;
+			count = HYM8563_T_COUNT_MAX;
+		}
+		st.target = now_sec * NSEC_PER_SEC +
+			div_u64((k_now + count) * NSEC_PER_SEC,
+				hym8563_fast_srcs[i].hz);
+	} else if (delta_sec <= HYM8563_T_COUNT_MAX) {
+		td = HYM8563_TD_1HZ;
+		count = delta_sec;
+		st.target = dl_sec * NSEC_PER_SEC;
+	} else if (delta_sec <= HYM8563_T_COUNT_MAX * 60) {
+		/* the first 1/60 Hz tick may come at any point of the minute */
+		td = HYM8563_TD_1_60HZ;
+		count = div_s64(delta_sec, 60);
+		st.exact = false;
+	}
+
+	st.src = count ? XHRTC_EVENT_TIMER : XHRTC_EVENT_ALARM;
+	if (count) {
+		pr_debug("timer td=%u count=%u for %lld.%09lld\n", td, count,
+			 dl_sec, dl_ns - dl_sec * NSEC_PER_SEC);
+		hym8563_txn_stage(&txn, RTC_T_COUNT, count);
+		hym8563_txn_stage(&txn, RTC_T_CTL, TE | td);
+		hym8563->timer_owned = true;
+		/* only one source may be armed, the queue owns both */
+		ctl2 = TIE;
+		/* leave any pending AF/TF for the interrupt handler */
+		hym8563_txn_stage(&txn, RTC_CTL2, ctl2 | AF | TF);
+	} else {
+		pr_debug("alarm at minute of %lld\n", dl_sec);
+		div_s64_rem(dl_sec, 60, &rem);
+		dl_sec -= rem;
+		hym8563_txn_stage(&txn, RTC_T_CTL, TD0 | TD1);
+		hym8563_scratch_release(hym8563, &txn);
+		hym8563_stage_alarm(&txn, dl_sec);
+		st.target = dl_sec * NSEC_PER_SEC;
+		/* the timer is stopped and stale AF/TF are dropped with this write */
+		ctl2 = AIE;
+		hym8563_txn_stage(&txn, RTC_CTL2, ctl2);
+	}
+
+	st.target = hym8563_raw_to_true(hym8563, st.target);
+
+	hym8563_lock(hym8563, op);
+	hym8563->ctl2 = ctl2;
+	ret = hym8563_txn_commit(hym8563, &txn);
+	hym8563->tick_running = !ret && td == HYM8563_TD_1HZ && count == 1;
+	hym8563_stage_arm(hym8563, &st, ret);
+	hym8563_unlock(hym8563);
+	hym8563->program_commits++;
+
+	return ret;
+}
+
+/*
+ * @keep_tick leaves a 1 Hz tick that just fired running with TIE on, as
+ * the next second is likely wanted too. If it is not, the next tick finds
+ * nothing armed and stops the timer.
+ */
+static int hym8563_disarm(struct hym8563 *hym8563, enum hym8563_op op,
+			  bool keep_tick)
+{
+	struct hym8563_txn txn;
+	int ret;
+
+	if ((keep_tick && hym8563->tick_running) || hym8563->pie_hz)
+		return 0;
+
+	hym8563_lock(hym8563, op);
+	hym8563->stage_live = false;
+	/* nothing enabled and nothing counting, as after an earlier disarm */
+	if (!(hym8563->ctl2 & (AIE | TIE)) && !hym8563->timer_owned &&
+	    !hym8563->tick_running) {
+		hym8563_unlock(hym8563);
+		return 0;
+	}
+	hym8563->tick_running = false;
+	hym8563_txn_init(&txn);
+	hym8563_txn_stage(&txn, RTC_T_CTL, TD0 | TD1);
+	hym8563_scratch_release(hym8563, &txn);
+	hym8563->ctl2 = 0;
+	hym8563_txn_stage(&txn, RTC_CTL2, hym8563->ctl2);
+	ret = hym8563_txn_commit(hym8563, &txn);
+	hym8563_unlock(hym8563);
+	hym8563->program_commits++;
+
+	return ret;
+}
+
+/*
+ * Software alarm queue. The chip has a single alarm and a single timer,
+ * so every user (the rtc class, the xh_rtc device and the exported
+ * kernel API) queues its wakeups here and the hardware is always armed
+ * for the earliest one. Entries are keyed by RTC time in seconds.
+ */
+enum {
+	HYM8563_ALARM_RTC,
+	HYM8563_ALARM_XHRTC,
+	HYM8563_ALARM_KERNEL,	/* this and later owners are allocated and in the idr */
+	HYM8563_ALARM_USER,
+};
+
+static void hym8563_alarm_init(struct hym8563_alarm *entry, int owner)
+{
+	timerqueue_init(&entry->node);
+	entry->owner = owner;
+	entry->id = owner == HYM8563_ALARM_RTC ? -1 : 0;
+}
+
+static bool hym8563_alarm_queued(struct hym8563_alarm *entry)
+{
+	return !RB_EMPTY_NODE(&entry->node.node);
+}
+
+/* forget an allocated entry that is no longer queued */
+static void hym8563_alarm_drop(struct hym8563 *hym8563,
+			       struct hym8563_alarm *entry)
+{
+	idr_remove(&hym8563->alarm_idr, entry->id);
+	hym8563->nr_alarms--;
+	kfree(entry);
+}
+
+static void hym8563_alarm_dequeue(struct hym8563 *hym8563,
+				  struct hym8563_alarm *entry)
+{
+	timerqueue_del(&hym8563->alarms, &entry->node);
+	if (entry->owner >= HYM8563_ALARM_KERNEL)
+		hym8563_alarm_drop(hym8563, entry);
+}
+
+/*
+ * Single producer ring: events are only pushed with the alarm lock held,
+ * readers serialise on event_read_lock and never block the producer.
+ */
+static void hym8563_event_push(struct hym8563 *hym8563,
+			       const struct xhrtc_event *ev)
+{
+	unsigned int head = hym8563->event_head;
+	unsigned int tail = smp_load_acquire(&hym8563->event_tail);
+
+	if (head - tail >= XHRTC_EVENT_RING) {
+		hym8563->event_overruns++;
+		return;
+	}
+
+	hym8563->events[head & (XHRTC_EVENT_RING - 1)] = *ev;
+	smp_store_release(&hym8563->event_head, head + 1);
+	wake_up_interruptible(&hym8563->event_wait);
+}
+
+static bool hym8563_event_pending(struct hym8563 *hym8563)
+{
+	return smp_load_acquire(&hym8563->event_head) !=
+	       ACCESS_ONCE(hym8563->event_tail);
+}
+
+/*
+ * Drop everything due at @now_ns and report it to readers of the event
+ * stream. Returns how many entries fired.
+ */
+static int hym8563_alarm_expire(struct hym8563 *hym8563, s64 now_ns,
+				u32 source, ktime_t stamp)
+{
+	struct timerqueue_node *next;
+	struct hym8563_alarm *entry;
+	struct xhrtc_event ev;
+	int expired = 0;
+
+	while ((next = timerqueue_getnext(&hym8563->alarms))) {
+		if (ktime_to_ns(next->expires) > now_ns)
+			break;
+		entry = container_of(next, struct hym8563_alarm, node);
+		ev.id = entry->id;
+		ev.source = source;
+		ev.expires_ns = ktime_to_ns(next->expires);
+		ev.irq_ns = ktime_to_ns(stamp);
+		hym8563_alarm_dequeue(hym8563, entry);
+		hym8563_event_push(hym8563, &ev);
+		expired++;
+	}
+	return expired;
+}
+
+static void hym8563_latency_record(struct hym8563 *hym8563, ktime_t stamp)
+{
+	s64 us = ktime_to_us(ktime_sub(ktime_get(), stamp));
+
+	hym8563->irq_latency[hym8563_log2_bucket(us)]++;
+}
+
+/* expire everything due at @now_ns and tell the rtc core about it */
+static int hym8563_alarm_notify(struct hym8563 *hym8563, s64 now_ns,
+				u32 source, ktime_t stamp)
+{
+	int expired = hym8563_alarm_expire(hym8563, now_ns, source, stamp);
+
+	if (expired) {
+		rtc_update_irq(hym8563->rtc, 1, RTC_IRQF | RTC_AF);
+		if (source != XHRTC_EVENT_EXPIRED)
+			hym8563_latency_record(hym8563, stamp);
+	}
+	return expired;
+}
+
+/*
+ * The tick count would do as a clock, but ticks arriving while the
+ * thread runs with the line masked are merged, so CLOCK_MONOTONIC
+ * stands in for it. Called with the alarm lock held.
+ */
+static s64 hym8563_pie_now(struct hym8563 *hym8563, ktime_t stamp)
+{
+	return hym8563->pie_base_ns +
+	       ktime_to_ns(ktime_sub(stamp, hym8563->pie_base_stamp));
+}
+
+/*
+ * The time for a rearm in ns, and whether we know where in the second
+ * it is. A running 1 Hz tick marks every edge, see hym8563_tick_phase(),
+ * so then it is known without a read: in the interrupt, in the rtc
+ * core's set_alarm for the next second and in between. Otherwise the
+ * chip is read, and right after a stage fired the phase is at its
+ * target for exact stages, or at the edge just read otherwise.
+ */
+static int hym8563_rearm_time(struct hym8563 *hym8563, enum hym8563_op op,
+			      bool fired, s64 *now_ns, bool *phase_known)
+{
+	struct rtc_time now;
+	unsigned long now_sec;
+	s64 base;
+	int ret;
+
+	/* already counted as due to the end of its second if need be */
+	if (hym8563->pie_hz) {
+		*now_ns = hym8563_pie_now(hym8563, ktime_get());
+		*phase_known = true;
+		return 0;
+	}
+
+	if (hym8563->tick_running &&
+	    hym8563_phase_predict(hym8563, ktime_get(), &base)) {
+		*now_ns = hym8563_raw_to_true(hym8563, base);
+		*phase_known = true;
+		return 0;
+	}
+
+	ret = hym8563_read_datetime(hym8563->client, &now, op);
+	if (ret)
+		return ret;
+	rtc_tm_to_time(&now, &now_sec);
+	*now_ns = hym8563_raw_to_true(hym8563, (s64)now_sec * NSEC_PER_SEC);
+
+	if (fired) {
+		base = hym8563->fired.exact ? hym8563->fired.target : *now_ns;
+		base += ktime_to_ns(ktime_sub(ktime_get(), hym8563->irq_stamp));
+		if (abs(base - *now_ns) < 2 * NSEC_PER_SEC) {
+			*now_ns = base;
+			*phase_known = true;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Bring the hardware in line with the head of the queue. Unless a stage
+ * just fired, nothing is read or written when the head is what the chip
+ * is already armed for, so adding or removing a later entry costs no bus
+ * traffic. The time is only read when something may be due or has to be
+ * programmed.
+ */
+static int hym8563_alarm_rearm(struct hym8563 *hym8563, enum hym8563_op op)
+{
+	struct timerqueue_node *next;
+	s64 now_ns;
+	bool phase_known = false, fired = hym8563->stage_fired;
+	u32 source = XHRTC_EVENT_EXPIRED;
+	ktime_t stamp = ktime_get();
+	int ret;
+
+	next = timerqueue_getnext(&hym8563->alarms);
+	if (!fired) {
+		if (next && hym8563->armed &&
+		    ktime_compare(next->expires, hym8563->armed_expires) == 0)
+			return 0;
+		if (!next) {
+			hym8563->armed = false;
+			return hym8563_disarm(hym8563, op, false);
+		}
+	}
+
+	ret = hym8563_rearm_time(hym8563, op, fired, &now_ns, &phase_known);
+	if (ret) {
+		/* stage_fired is kept, the next update redoes this */
+		hym8563->armed = false;
+		return ret;
+	}
+	if (fired) {
+		hym8563->stage_fired = false;
+		source = hym8563->fired.src;
+		stamp = hym8563->irq_stamp;
+	}
+
+	/*
+	 * Without the phase we are somewhere in the second just read, and
+	 * counting a deadline inside it from the start of the second could
+	 * fire up to a second late. Treat the whole second as due instead.
+	 */
+	hym8563_alarm_notify(hym8563, phase_known ? now_ns :
+			     now_ns + NSEC_PER_SEC - 1, source, stamp);
+
+	next = timerqueue_getnext(&hym8563->alarms);
+	if (!next) {
+		/* a stage that just fired may still have its timer counting */
+		hym8563->armed = false;
+		return hym8563_disarm(hym8563, op, fired);
+	}
+
+	if (hym8563->armed && ktime_compare(next->expires, hym8563->armed_expires) == 0)
+		return 0;
+
+	ret = hym8563_program_alarm(hym8563, next->expires, now_ns, phase_known, op);
+	hym8563->armed = !ret;
+	hym8563->armed_expires = next->expires;
+	return ret;
+}
+
+static void hym8563_rearm_work(struct work_struct *work)
+{
+	struct hym8563 *hym8563 = container_of(work, struct hym8563, rearm_work);
+	int ret;
+
+	mutex_lock(&hym8563->alarm_lock);
+	ret = hym8563_alarm_rearm(hym8563, HYM8563_OP_SET_ALARM);
+	mutex_unlock(&hym8563->alarm_lock);
+
+	if (ret)
+		dev_err(&hym8563->client->dev, "deferred alarm programming failed: %d\n", ret);
+}
+
+/*
+ * Push a queue change to the chip. In async mode the work item reads the
+ * queue when it runs, so a burst of updates costs a single commit of
+ * whatever ended up at the head. Must be called with the alarm lock held.
+ */
+static int hym8563_alarm_update(struct hym8563 *hym8563, enum hym8563_op op)
+{
+	hym8563->program_requests++;
+	if (hym8563->async_program) {
+		schedule_work(&hym8563->rearm_work);
+		return 0;
+	}
+	return hym8563_alarm_rearm(hym8563, op);
+}
+
+/*
+ * (Re)queue one of the embedded per-interface entries. Must be called
+ * with the alarm lock held.
+ */
+static int hym8563_alarm_queue_slot(struct hym8563 *hym8563,
+				    struct hym8563_alarm *entry,
+				    bool enabled, ktime_t expires,
+				    enum hym8563_op op)
+{
+	if (hym8563_alarm_queued(entry))
+		hym8563_alarm_dequeue(hym8563, entry);
+	if (enabled) {
+		entry->node.expires = expires;
+		timerqueue_add(&hym8563->alarms, &entry->node);
+	}
+	return hym8563_alarm_update(hym8563, op);
+}
+
+static int hym8563_alarm_set_slot(struct hym8563 *hym8563,
+				  struct hym8563_alarm *entry,
+				  bool enabled, ktime_t expires,
+				  enum hym8563_op op)
+{
+	int ret;
+
+	mutex_lock(&hym8563->alarm_lock);
+	ret = hym8563_alarm_queue_slot(hym8563, entry, enabled, expires, op);
+	mutex_unlock(&hym8563->alarm_lock);
+
+	return ret;
+}
+
+/* re-derive the hardware setup after the time base changed */
+static int hym8563_alarm_resync(struct hym8563 *hym8563, enum hym8563_op op)
+{
+	int ret;
+
+	mutex_lock(&hym8563->alarm_lock);
+	hym8563->armed = false;
+	ret = hym8563_alarm_update(hym8563, op);
+	mutex_unlock(&hym8563->alarm_lock);
+
+	return ret;
+}
+
+/*
+ * Periodic interrupts. The countdown reloads from 1 on every period and,
+ * with TI set, pulses INT for each one without waiting for TF to be
+ * cleared, so ticks cost no bus traffic. INT only ever carries ticks
+ * meanwhile: the alarm queue is polled from them and the chip alarm stays
+ * off. Called with hz 0 to stop.
+ */
+/* thread wakeups for coalesced ticks are capped at this rate */
+#define HYM8563_PIE_THREAD_HZ	64
+
+/*
+ * The time while ticks run, see hym8563_pie_now(), starts from the
+ * edge if one is known and from a read otherwise. A read only gives
+ * the second, and as in hym8563_alarm_rearm() all of it counts as due.
+ */
+static int hym8563_pie_anchor(struct hym8563 *hym8563, enum hym8563_op op)
+{
+	ktime_t stamp = ktime_get();
+	struct rtc_time now;
+	unsigned long sec;
+	s64 raw_ns;
+	int ret;
+
+	if (hym8563_phase_predict(hym8563, stamp, &raw_ns)) {
+		hym8563->pie_base_ns = hym8563_raw_to_true(hym8563, raw_ns);
+	} else {
+		ret = hym8563_read_datetime(hym8563->client, &now, op);
+		if (ret)
+			return ret;
+		stamp = ktime_get();
+		rtc_tm_to_time(&now, &sec);
+		hym8563->pie_base_ns = hym8563_raw_to_true(hym8563,
+				(s64)sec * NSEC_PER_SEC) + NSEC_PER_SEC - 1;
+	}
+	hym8563->pie_base_stamp = stamp;
+	return 0;
+}
+
+static unsigned int hym8563_pie_get(struct hym8563 *hym8563)
+{
+	unsigned int hz;
+
+	mutex_lock(&hym8563->alarm_lock);
+	hz = hym8563->pie_hz;
+	mutex_unlock(&hym8563->alarm_lock);
+	return hz;
+}
+
+static int hym8563_pie_set(struct hym8563 *hym8563, unsigned long hz,
+			   enum hym8563_op op)
+{
+	struct hym8563_txn txn;
+	u8 td, ctl2;
+	int ret;
+
+	switch (hz) {
+	case 0:
+	case 4096:
+		td = 0;
+		break;
+	case 64:
+		td = TD0;
+		break;
+	case 1:
+		td = TD1;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	mutex_lock(&hym8563->alarm_lock);
+	if (hz) {
+		ret = hym8563_pie_anchor(hym8563, op);
+		if (ret)
+			goto out;
+	}
+	hym8563_txn_init(&txn);
+	if (hz) {
+		hym8563_txn_stage(&txn, RTC_T_COUNT, 1);
+		hym8563_txn_stage(&txn, RTC_T_CTL, TE | td);
+		hym8563->timer_owned = true;
+		ctl2 = TIE | TI;
+	} else {
+		hym8563_txn_stage(&txn, RTC_T_CTL, TD0 | TD1);
+		hym8563_scratch_release(hym8563, &txn);
+		ctl2 = 0;
+	}
+	/* a due alarm is found by the rearm below, not by its flag */
+	hym8563_txn_stage(&txn, RTC_CTL2, ctl2);
+
+	hym8563_lock(hym8563, op);
+	hym8563->ctl2 = ctl2;
+	/* whatever stage was armed is gone with this commit */
+	hym8563->stage_live = false;
+	ret = hym8563_txn_commit(hym8563, &txn);
+	if (!ret) {
+		ACCESS_ONCE(hym8563->pie_hz) = hz;
+		hym8563->tick_running = false;
+	}
+	hym8563_unlock(hym8563);
+	atomic_set(&hym8563->pie_ticks, 0);
+
+	/* move the queue between the ticks and the chip alarm */
+	hym8563->armed = false;
+	if (!ret)
+		ret = hym8563_alarm_rearm(hym8563, op);
+out:
+	mutex_unlock(&hym8563->alarm_lock);
+
+	return ret;
+}
+
+static int hym8563_rtc_set_time(struct device *dev, struct rtc_time *tm)
+{
+	struct i2c_client *client = to_i2c_client(dev);
+	struct hym8563 *hym8563 = i2c_get_clientdata(client);
+	ktime_t start = ktime_get();
+	unsigned long sec;
+	s64 anchor;
+	s32 ppb;
+	int ret;
+
+	rtc_tm_to_time(tm, &sec);
+	hym8563_drift_measure(hym8563, sec);
+	if (hym8563->precise_time)
+		ret = hym8563_set_time_precise(hym8563, tm, &sec);
+	else
+		ret = hym8563_set_time(client, tm);
+	if (!ret) {
+		/* chip and true time agree again from here */
+		hym8563_drift_get(hym8563, &ppb, &anchor);
+		hym8563_drift_set(hym8563, ppb, sec);
+		hym8563_alarm_resync(hym8563, HYM8563_OP_SET_TIME);
+	}
+	return hym8563_op_end(hym8563, HYM8563_OP_SET_TIME, start, ret);
+}
+
+static int hym8563_rtc_read_alarm(struct device *dev, struct rtc_wkalrm *tm)
+{
+	struct i2c_client *client = to_i2c_client(dev);
+	struct hym8563 *hym8563 = i2c_get_clientdata(client);
+	
+	pr_debug("enter\n");
+	/* the chip may be armed for another user, report the queued rtc alarm */
+	mutex_lock(&hym8563->alarm_lock);
+	*tm = hym8563->alarm;
+	tm->enabled = hym8563_alarm_queued(&hym8563->rtc_alarm);
+	mutex_unlock(&hym8563->alarm_lock);
+	return 0;
+}
+
+static int hym8563_rtc_set_alarm(struct device *dev, struct rtc_wkalrm *alarm)
+{
+	struct hym8563 *hym8563 = i2c_get_clientdata(to_i2c_client(dev));
+	ktime_t start = ktime_get();
+	unsigned long sec;
+	int ret;
+
+	rtc_tm_to_time(&alarm->time, &sec);
+	/* read_alarm reports it, under the lock */
+	mutex_lock(&hym8563->alarm_lock);
+	hym8563->alarm = *alarm;
+	ret = hym8563_alarm_queue_slot(hym8563, &hym8563->rtc_alarm,
+				       alarm->enabled, ktime_set(sec, 0),
+				       HYM8563_OP_SET_ALARM);
+	mutex_unlock(&hym8563->alarm_lock);
+	return hym8563_op_end(hym8563, HYM8563_OP_SET_ALARM, start, ret);
+}
+
+static int xh_rtc_set_alarm(struct hym8563 *hym8563, struct timespec *ts)
+{	
+	return hym8563_alarm_set_slot(hym8563, &hym8563->xh_alarm, true,
+				      ktime_set(ts->tv_sec, ts->tv_nsec),
+				      HYM8563_OP_IOCTL);
+}
+
+static int hym8563_add_alarm(struct hym8563 *hym8563, unsigned long sec)
+{
+	struct hym8563_alarm *entry;
+	int id, ret;
+
+	entry = kzalloc(sizeof(*entry), GFP_KERNEL);
+	if (!entry)
+		return -ENOMEM;
+	hym8563_alarm_init(entry, HYM8563_ALARM_KERNEL);
+	entry->node.expires = ktime_set(sec, 0);
+
+	mutex_lock(&hym8563->alarm_lock);
+	if (hym8563->nr_alarms >= HYM8563_MAX_ALARMS) {
+		id = -ENOSPC;
+		goto err;
+	}
+	id = idr_alloc(&hym8563->alarm_idr, entry, 1, 0, GFP_KERNEL);
+	if (id < 0)
+		goto err;
+	entry->id = id;
+	hym8563->nr_alarms++;
+	timerqueue_add(&hym8563->alarms, &entry->node);
+	ret = hym8563_alarm_update(hym8563, HYM8563_OP_SET_ALARM);
+	/*
+	 * On failure the caller gets no id to delete the entry with, so it
+	 * comes back out and the chip is rearmed without it. One that has
+	 * already expired was reported under its id and is kept.
+	 */
+	if (ret && idr_find(&hym8563->alarm_idr, id) == entry) {
+		hym8563_alarm_dequeue(hym8563, entry);
+		hym8563_alarm_update(hym8563, HYM8563_OP_SET_ALARM);
+		id = ret;
+	}
+	mutex_unlock(&hym8563->alarm_lock);
+
+	return id;
+
+err:
+	mutex_unlock(&hym8563->alarm_lock);
+	kfree(entry);
+	return id;
+}
+
+static int hym8563_del_alarm(struct hym8563 *hym8563, int id)
+{
+	struct hym8563_alarm *entry;
+	int ret = -ENOENT;
+
+	mutex_lock(&hym8563->alarm_lock);
+	entry = idr_find(&hym8563->alarm_idr, id);
+	if (entry) {
+		hym8563_alarm_dequeue(hym8563, entry);
+		ret = hym8563_alarm_update(hym8563, HYM8563_OP_SET_ALARM);
+	}
+	mutex_unlock(&hym8563->alarm_lock);
+
+	return ret;
+}
+
+/*
+ * Queue an independent wakeup at @sec (RTC time, seconds since the
+ * epoch) on chip @index. Returns an id for xh_rtc_del_alarm_idx() or a
+ * negative errno.
+ */
+int xh_rtc_add_alarm_idx(int index, unsigned long sec)
+{
+	struct hym8563 *hym8563;
+	int ret = -ENODEV;
+
+	down_read(&hym8563_list_sem);
+	hym8563 = hym8563_find(index);
+	if (hym8563)
+		ret = hym8563_add_alarm(hym8563, sec);
+	up_read(&hym8563_list_sem);
+
+	return ret;
+}
+EXPORT_SYMBOL(xh_rtc_add_alarm_idx);
+
+int xh_rtc_del_alarm_idx(int index, int id)
+{
+	struct hym8563 *hym8563;
+	int ret = -ENODEV;
+
+	down_read(&hym8563_list_sem);
+	hym8563 = hym8563_find(index);
+	if (hym8563)
+		ret = hym8563_del_alarm(hym8563, id);
+	up_read(&hym8563_list_sem);
+
+	return ret;
+}
+EXPORT_SYMBOL(xh_rtc_del_alarm_idx);
+
+/* the single-chip API acts on xh_rtc0 */
+int xh_rtc_add_alarm(unsigned long sec)
+{
+	return xh_rtc_add_alarm_idx(0, sec);
+}
+EXPORT_SYMBOL(xh_rtc_add_alarm);
+
+int xh_rtc_del_alarm(int id)
+{
+	return xh_rtc_del_alarm_idx(0, id);
+}
+EXPORT_SYMBOL(xh_rtc_del_alarm);
+
+static struct hym8563_alarm *hym8563_batch_lookup(struct hym8563 *hym8563, int id)
+{
+	struct hym8563_alarm *entry = idr_find(&hym8563->alarm_idr, id);
+
+	return entry && entry->owner == HYM8563_ALARM_USER ? entry : NULL;
+}
+
+static int hym8563_batch_validate(const struct xhrtc_alarm_batch *batch,
+				  const struct xhrtc_batch_entry *ents)
+{
+	int i, j;
+
+	if (batch->flags & ~XHRTC_BATCH_REPLACE || batch->count > XHRTC_BATCH_MAX)
+		return -EINVAL;
+
+	for (i = 0; i < batch->count; i++) {
+		if (ents[i].flags & ~XHRTC_ENTRY_CANCEL || ents[i].id < 0)
+			return -EINVAL;
+		if (ents[i].flags & XHRTC_ENTRY_CANCEL) {
+			if (!ents[i].id)
+				return -EINVAL;
+		} else if (ents[i].tv_sec < 0 || ents[i].tv_sec >= KTIME_SEC_MAX ||
+			   ents[i].tv_nsec < 0 || ents[i].tv_nsec >= NSEC_PER_SEC) {
+			return -EINVAL;
+		}
+		if (!ents[i].id)
+			continue;
+		if (batch->flags & XHRTC_BATCH_REPLACE)
+			return -EINVAL;
+		for (j = 0; j < i; j++)
+			if (ents[j].id == ents[i].id)
+				return -EINVAL;
+	}
+	return 0;
+}
+
+/*
+ * Take a batch back out after the chip could not be programmed for it.
+ * Batch alarms are queued for as long as they are in the idr, so the
+ * ones that are not were replaced or cancelled by the batch and go back
+ * in. Whatever expired during the failed commit was reported and stays
+ * gone.
+ */
+static void hym8563_alarm_batch_undo(struct hym8563 *hym8563,
+				     const struct xhrtc_alarm_batch *batch,
+				     struct hym8563_alarm **fresh,
+				     const ktime_t *prev,
+				     const struct xhrtc_batch_entry *ents)
+{
+	struct hym8563_alarm *entry;
+	int i, id;
+
+	for (i = 0; i < batch->count; i++) {
+		/* fresh[i] may be freed, its id is in ents[i] */
+		entry = hym8563_batch_lookup(hym8563, ents[i].id);
+		if (!entry || (fresh[i] && entry != fresh[i]) ||
+		    !hym8563_alarm_queued(entry))
+			continue;
+		if (fresh[i]) {
+			hym8563_alarm_dequeue(hym8563, entry);
+		} else {
+			timerqueue_del(&hym8563->alarms, &entry->node);
+			entry->node.expires = prev[i];
+			timerqueue_add(&hym8563->alarms, &entry->node);
+		}
+	}
+	idr_for_each_entry(&hym8563->alarm_idr, entry, id)
+		if (entry->owner == HYM8563_ALARM_USER &&
+		    !hym8563_alarm_queued(entry))
+			timerqueue_add(&hym8563->alarms, &entry->node);
+}
+
+/*
+ * Apply a validated batch. New entries are allocated up front and only
+ * enter the idr once every referenced id has been found, so a batch
+ * that fails validation leaves the queue untouched. Replaced and
+ * cancelled alarms are only freed once the chip has been programmed;
+ * if that fails the batch is undone. Returns the number of armed
+ * entries.
+ */
+static int hym8563_alarm_batch(struct hym8563 *hym8563,
+			       const struct xhrtc_alarm_batch *batch,
+			       struct xhrtc_batch_entry *ents)
+{
+	struct hym8563_alarm **fresh;
+	struct hym8563_alarm *entry;
+	ktime_t *prev;
+	int i, id, nr_new = 0, nr_old = 0, armed = 0, ret = 0;
+
+	fresh = kcalloc(batch->count, sizeof(*fresh), GFP_KERNEL);
+	if (batch->count && !fresh)
+		return -ENOMEM;
+	prev = kcalloc(batch->count, sizeof(*prev), GFP_KERNEL);
+	if (batch->count && !prev) {
+		kfree(fresh);
+		return -ENOMEM;
+	}
+	for (i = 0; i < batch->count; i++) {
+		if (ents[i].id)
+			continue;
+		fresh[i] = kzalloc(sizeof(*fresh[i]), GFP_KERNEL);
+		if (!fresh[i]) {
+			ret = -ENOMEM;
+			goto out_free;
+		}
+		hym8563_alarm_init(fresh[i], HYM8563_ALARM_USER);
+		nr_new++;
+	}
+
+	mutex_lock(&hym8563->alarm_lock);
+	for (i = 0; i < batch->count; i++) {
+		if (ents[i].id && !hym8563_batch_lookup(hym8563, ents[i].id)) {
+			ret = -ENOENT;
+			goto out_unlock;
+		}
+	}
+	if (batch->flags & XHRTC_BATCH_REPLACE)
+		idr_for_each_entry(&hym8563->alarm_idr, entry, id)
+			if (entry->owner == HYM8563_ALARM_USER)
+				nr_old++;
+	if (hym8563->nr_alarms - nr_old + nr_new > HYM8563_MAX_ALARMS) {
+		ret = -ENOSPC;
+		goto out_unlock;
+	}
+	for (i = 0; i < batch->count; i++) {
+		if (!fresh[i])
+			continue;
+		id = idr_alloc(&hym8563->alarm_idr, fresh[i], 1, 0, GFP_KERNEL);
+		if (id < 0) {
+			while (i--)
+				if (fresh[i])
+					idr_remove(&hym8563->alarm_idr, fresh[i]->id);
+			ret = id;
+			goto out_unlock;
+		}
+		fresh[i]->id = id;
+	}
+
+	/* out of the queue but still in the idr until the commit is in */
+	if (batch->flags & XHRTC_BATCH_REPLACE)
+		idr_for_each_entry(&hym8563->alarm_idr, entry, id)
+			if (entry->owner == HYM8563_ALARM_USER &&
+			    hym8563_alarm_queued(entry))
+				timerqueue_del(&hym8563->alarms, &entry->node);
+
+	for (i = 0; i < batch->count; i++) {
+		if (fresh[i]) {
+			entry = fresh[i];
+			hym8563->nr_alarms++;
+		} else {
+			entry = hym8563_batch_lookup(hym8563, ents[i].id);
+			prev[i] = entry->node.expires;
+			timerqueue_del(&hym8563->alarms, &entry->node);
+			if (ents[i].flags & XHRTC_ENTRY_CANCEL)
+				continue;
+		}
+		entry->node.expires = ktime_set(ents[i].tv_sec, ents[i].tv_nsec);
+		timerqueue_add(&hym8563->alarms, &entry->node);
+		ents[i].id = entry->id;
+		armed++;
+	}
+	ret = hym8563_alarm_update(hym8563, HYM8563_OP_IOCTL);
+	if (ret) {
+		hym8563_alarm_batch_undo(hym8563, batch, fresh, prev, ents);
+		hym8563_alarm_update(hym8563, HYM8563_OP_IOCTL);
+	} else {
+		idr_for_each_entry(&hym8563->alarm_idr, entry, id)
+			if (entry->owner == HYM8563_ALARM_USER &&
+			    !hym8563_alarm_queued(entry))
+				hym8563_alarm_drop(hym8563, entry);
+	}
+	mutex_unlock(&hym8563->alarm_lock);
+	kfree(prev);
+	kfree(fresh);
+
+	return ret ? ret : armed;
+
+out_unlock:
+	mutex_unlock(&hym8563->alarm_lock);
+out_free:
+	for (i = 0; i < batch->count; i++)
+		kfree(fresh[i]);
+	kfree(prev);
+	kfree(fresh);
+	return ret;
+}
+
+/* drop every alarm, the interrupt and the rtc device are gone by now */
+static void hym8563_alarm_release(struct hym8563 *hym8563)
+{
+	struct timerqueue_node *next;
+	struct hym8563_alarm *entry;
+	int id;
+
+	mutex_lock(&hym8563->alarm_lock);
+	while ((next = timerqueue_getnext(&hym8563->alarms)))
+		hym8563_alarm_dequeue(hym8563,
+				      container_of(next, struct hym8563_alarm, node));
+	/* disabled entries are in the idr only */
+	idr_for_each_entry(&hym8563->alarm_idr, entry, id)
+		kfree(entry);
+	idr_destroy(&hym8563->alarm_idr);
+	hym8563->armed = false;
+	mutex_unlock(&hym8563->alarm_lock);
+}
+#ifdef CONFIG_HDMI_SAVE_DATA
+int hdmi_get_data_idx(int index)
+{
+    struct hym8563 *hym8563;
+    u8 regs=0;
+
+    down_read(&hym8563_list_sem);
+    hym8563 = hym8563_find(index);
+    if(hym8563)
+        regs = hym8563_scratch_read(hym8563);
+    up_read(&hym8563_list_sem);
+    if(!hym8563)
+    {
+        pr_debug("%s rtc%d has no init\n",__func__,index);
+        return -1;
+    }
+    if(regs==0 || regs==0xff){
+        pr_debug("%s rtc%d has no hdmi data\n",__func__,index);
+        return -1;
+    }
+    return (regs-1);
+}
+
+int hdmi_set_data_idx(int index, int data)
+{
+    struct hym8563 *hym8563;
+    u8 regs = (data+1)&0xff;
+    int ret = -1;
+
+    down_read(&hym8563_list_sem);
+    hym8563 = hym8563_find(index);
+    if(hym8563)
+        ret = hym8563_scratch_write(hym8563, regs);
+    up_read(&hym8563_list_sem);
+    if(!hym8563)
+    {
+        pr_debug("%s rtc%d has no init\n",__func__,index);
+        return -1;
+    }   
+    return ret;
+}
+
+int hdmi_get_data(void)
+{
+    return hdmi_get_data_idx(0);
+}
+
+int hdmi_set_data(int data)
+{
+    return hdmi_set_data_idx(0, data);
+}
+
+EXPORT_SYMBOL(hdmi_get_data_idx);
+EXPORT_SYMBOL(hdmi_set_data_idx);
+EXPORT_SYMBOL(hdmi_get_data);
+EXPORT_SYMBOL(hdmi_set_data);
+#endif
+#if defined(CONFIG_RTC_INTF_DEV) || defined(CONFIG_RTC_INTF_DEV_MODULE)
+static int hym8563_i2c_open_alarm(struct i2c_client *client)
+{
+	struct hym8563 *hym8563 = i2c_get_clientdata(client);
+
+	int ret;
+
+	hym8563_lock(hym8563, HYM8563_OP_IOCTL);
+	hym8563->ctl2 |= AIE;
+	ret = hym8563_write_ctl2(hym8563, false);
+	hym8563_unlock(hym8563);
+	return ret;
+}
+
+static int hym8563_i2c_close_alarm(struct i2c_client *client)
+{
+	struct hym8563 *hym8563 = i2c_get_clientdata(client);
+
+	int ret;
+
+	hym8563_lock(hym8563, HYM8563_OP_IOCTL);
+	hym8563->ctl2 &= ~AIE;
+	ret = hym8563_write_ctl2(hym8563, false);
+	hym8563_unlock(hym8563);
+	return ret;
+}
+
+static int hym8563_rtc_ioctl(struct device *dev, unsigned int cmd, unsigned long arg)
+{
+	struct i2c_client *client = to_i2c_client(dev);
+	ktime_t start = ktime_get();
+	int ret;
+
+	switch (cmd) {
+	case RTC_AIE_OFF:
+		ret = hym8563_i2c_close_alarm(client);
+		break;
+	case RTC_AIE_ON:
+		ret = hym8563_i2c_open_alarm(client);
+		break;
+	/*
+	 * PIE and IRQP never get here: 4.3-4.7 cores emulate them with an
+	 * hrtimer. /dev/xh_rtc has XHRTC_SET_PERIODIC for the chip's ticks.
+	 */
+	default:
+		return -ENOIOCTLCMD;
+	}	
+	ret = ret < 0 ? -EIO : 0;
+	return hym8563_op_end(i2c_get_clientdata(client), HYM8563_OP_IOCTL,
+			      start, ret);
+}
+#else
+#define hym8563_rtc_ioctl NULL
+#endif
+
+#if defined(CONFIG_RTC_INTF_PROC) || defined(CONFIG_RTC_INTF_PROC_MODULE)
+static int hym8563_rtc_proc(struct device *dev, struct seq_file *seq)
+{
+	return 0;
+}
+#else
+#define hym8563_rtc_proc NULL
+#endif
+
+static int hym8563_cancel_xh_alarm(struct hym8563 *hym8563)
+{
+	return hym8563_alarm_set_slot(hym8563, &hym8563->xh_alarm, false,
+				      ktime_set(0, 0), HYM8563_OP_IOCTL);
+}
+
+int xh_rtc_cancle_alarm_idx(int index)
+{
+	struct hym8563 *hym8563;
+	int ret = -ENODEV;
+
+	pr_debug("xh_rtc_cancle_alarm %d\n", index);
+
+	down_read(&hym8563_list_sem);
+	hym8563 = hym8563_find(index);
+	if (hym8563)
+		ret = hym8563_cancel_xh_alarm(hym8563);
+	up_read(&hym8563_list_sem);
+
+	return ret;
+}EXPORT_SYMBOL(xh_rtc_cancle_alarm_idx);
+
+int xh_rtc_cancle_alarm(void)
+{
+	return xh_rtc_cancle_alarm_idx(0);
+}EXPORT_SYMBOL(xh_rtc_cancle_alarm);
+
+/*
+ * The rtc core turns its alarm off here once its timer queue runs empty,
+ * for instance when update interrupts stop, and back on after set_alarm.
+ */
+static int hym8563_rtc_alarm_irq_enable(struct device *dev,
+				       unsigned int enabled)
+{
+	struct hym8563 *hym8563 = i2c_get_clientdata(to_i2c_client(dev));
+	ktime_t start = ktime_get();
+	unsigned long sec = 0;
+	int ret;
+
+	mutex_lock(&hym8563->alarm_lock);
+	if (enabled && rtc_valid_tm(&hym8563->alarm.time)) {
+		ret = -EINVAL;
+		goto out;
+	}
+	if (enabled)
+		rtc_tm_to_time(&hym8563->alarm.time, &sec);
+	hym8563->alarm.enabled = enabled;
+	ret = hym8563_alarm_queue_slot(hym8563, &hym8563->rtc_alarm, enabled,
+				       ktime_set(sec, 0), HYM8563_OP_SET_ALARM);
+out:
+	mutex_unlock(&hym8563->alarm_lock);
+	return hym8563_op_end(hym8563, HYM8563_OP_SET_ALARM, start, ret);
+}
+static irqreturn_t hym8563_hard_irq(int irq, void *data)
+{
+	struct hym8563 *hym8563 = data;
+	unsigned int hz = ACCESS_ONCE(hym8563->pie_hz);
+
+	hym8563->hardirq_stamp = ktime_get();
+	/* fast ticks are counted here and handed to the thread in batches */
+	if (hz && atomic_inc_return(&hym8563->pie_ticks) <
+		  max_t(unsigned int, hz / HYM8563_PIE_THREAD_HZ, 1))
+		return IRQ_HANDLED;
+	return IRQ_WAKE_THREAD;
+}
+
+static void hym8563_pie_tick(struct hym8563 *hym8563, ktime_t stamp)
+{
+	struct xhrtc_event ev = {
+		.source = XHRTC_EVENT_PERIODIC,
+		.irq_ns = ktime_to_ns(stamp),
+	};
+	struct timerqueue_node *next;
+	int n = atomic_xchg(&hym8563->pie_ticks, 0);
+	s64 now_ns;
+
+	mutex_lock(&hym8563->alarm_lock);
+	if (n) {
+		ev.id = n;
+		hym8563_event_push(hym8563, &ev);
+	}
+
+	/* the head is checked against the ticks' clock, not the chip */
+	next = timerqueue_getnext(&hym8563->alarms);
+	now_ns = hym8563_pie_now(hym8563, stamp);
+	if (next && ktime_to_ns(next->expires) <= now_ns)
+		hym8563_alarm_notify(hym8563, now_ns, XHRTC_EVENT_EXPIRED, stamp);
+	mutex_unlock(&hym8563->alarm_lock);
+}
+
+/*
+ * The first interrupt after a wakeup-enabled suspend is what woke us. It
+ * is counted here rather than from CTL2 in resume, which would race with
+ * this thread's ack. The source is the stage the ack latched. Returns
+ * whether this was that interrupt.
+ */
+static bool hym8563_wake_account(struct hym8563 *hym8563, bool fired,
+				 const struct hym8563_stage *st)
+{
+	if (!atomic_xchg(&hym8563->wake_check, 0))
+		return false;
+
+	spin_lock(&hym8563->stats_lock);
+	if (fired && st->src == XHRTC_EVENT_TIMER)
+		hym8563->wake_timer++;
+	else
+		hym8563->wake_alarm++;
+	spin_unlock(&hym8563->stats_lock);
+	pm_wakeup_event(&hym8563->client->dev, HYM8563_WAKEUP_MS);
+	dev_dbg(&hym8563->client->dev, "woken by the %s\n",
+		fired && st->src == XHRTC_EVENT_TIMER ? "timer" : "alarm");
+	return true;
+}
+
+/*
+ * An exact timer stage ending on a whole second, the 1 Hz tick above all,
+ * marks a seconds edge at the hard irq stamp for the time cache.
+ */
+static void hym8563_tick_phase(struct hym8563 *hym8563,
+			       const struct hym8563_stage *st, ktime_t stamp)
+{
+	s64 raw_ns, sec;
+	s32 rem;
+
+	if (st->src != XHRTC_EVENT_TIMER || !st->exact)
+		return;
+	raw_ns = hym8563_true_to_raw(hym8563, st->target);
+	sec = div_s64_rem(raw_ns + NSEC_PER_SEC / 2, NSEC_PER_SEC, &rem);
+	if (abs(rem - (s32)(NSEC_PER_SEC / 2)) < HYM8563_PHASE_SLACK_NS)
+		hym8563_phase_set(hym8563, true, sec, stamp);
+}
+
+/*
+ * Ack and handle the interrupt raised at @stamp. Returns false if the
+ * ack did not reach the chip: AF/TF and INT are still set, and so is
+ * the stage, which has not been seen to fire yet.
+ */
+static bool hym8563_irq_service(struct hym8563 *hym8563, ktime_t stamp)
+{
+	struct hym8563_stage st = { 0, };
+	bool fired, woke;
+	int ret;
+
+	ACCESS_ONCE(hym8563->bus_urgent) = current;
+	/*
+	 * Ack AF/TF in one write from the shadow. TIE is masked so a
+	 * reloading countdown cannot fire again before rearming stops or
+	 * reprograms it; T_CTL itself is left for that. A 1 Hz tick is a
+	 * second away from firing again and stays unmasked.
+	 *
+	 * The stage is latched in the same section: one committed after the
+	 * edge did not fire, and none can be committed between ack and latch.
+	 */
+	hym8563_lock(hym8563, HYM8563_OP_IRQ);
+	if (!hym8563->tick_running)
+		hym8563->ctl2 &= ~TIE;
+	ret = hym8563_write_ctl2(hym8563, true);
+	if (ret < 0) {
+		hym8563_unlock(hym8563);
+		ACCESS_ONCE(hym8563->bus_urgent) = NULL;
+		hym8563_op_end(hym8563, HYM8563_OP_IRQ, stamp, ret);
+		return false;
+	}
+	fired = hym8563->stage_live &&
+		ktime_after(stamp, hym8563->stage.armed_at);
+	if (fired) {
+		st = hym8563->stage;
+		hym8563->stage_live = false;
+	}
+	hym8563_unlock(hym8563);
+	woke = hym8563_wake_account(hym8563, fired, &st);
+
+	mutex_lock(&hym8563->alarm_lock);
+	hym8563->stage_fired = fired;
+	hym8563->fired = st;
+	hym8563->irq_stamp = stamp;
+	hym8563->armed = false;
+	/* resume delays the interrupt that woke us by an unknown amount */
+	if (fired && !woke)
+		hym8563_tick_phase(hym8563, &st, stamp);
+	/*
+	 * A timer stage on the 1 Hz or a fast grid ends exactly at its target
+	 * and tells the time by itself, so report it before reading. The
+	 * 1/60 Hz tick only bounds it, and the minute alarm also matches a
+	 * month early, so those wait for the read and its sanity check.
+	 */
+	if (fired && st.src == XHRTC_EVENT_TIMER && st.exact)
+		hym8563_alarm_notify(hym8563, st.target, st.src, stamp);
+	hym8563_alarm_rearm(hym8563, HYM8563_OP_IRQ);
+	mutex_unlock(&hym8563->alarm_lock);
+	ACCESS_ONCE(hym8563->bus_urgent) = NULL;
+
+	hym8563_op_end(hym8563, HYM8563_OP_IRQ, stamp, 0);
+	return true;
+}
+
+/*
+ * The interrupt stays disabled while its ack is retried: an edge would
+ * not come again with INT still asserted, and a level would come back
+ * at once. Retries are spaced like the bus breaker's probes.
+ */
+static void hym8563_ack_defer(struct hym8563 *hym8563)
+{
+	dev_warn_ratelimited(&hym8563->client->dev,
+			     "interrupt ack failed, retrying\n");
+	schedule_delayed_work(&hym8563->ack_work,
+			      msecs_to_jiffies(hym8563->bus_cooldown_ms));
+}
+
+/* returns false while the ack keeps failing */
+static bool hym8563_ack_retry(struct hym8563 *hym8563)
+{
+	if (hym8563_irq_service(hym8563, hym8563->ack_stamp)) {
+		enable_irq(hym8563->irq);
+		return true;
+	}
+	hym8563_ack_defer(hym8563);
+	return false;
+}
+
+static void hym8563_ack_work(struct work_struct *work)
+{
+	struct hym8563 *hym8563 = container_of(to_delayed_work(work),
+					       struct hym8563, ack_work);
+
+	hym8563_ack_retry(hym8563);
+}
+
+static irqreturn_t hym8563_wakeup_irq(int irq, void *data)
+{
+	struct hym8563 *hym8563 = data;	
+	ktime_t stamp = hym8563->hardirq_stamp;
+
+	if (ACCESS_ONCE(hym8563->pie_hz)) {
+		hym8563_pie_tick(hym8563, stamp);
+		return IRQ_HANDLED;
+	}
+
+	if (!hym8563_irq_service(hym8563, stamp)) {
+		disable_irq_nosync(irq);
+		hym8563->ack_stamp = stamp;
+		hym8563_ack_defer(hym8563);
+	}
+	dev_dbg(&hym8563->client->dev, "irq %d\n", irq);
+	return IRQ_HANDLED;
+}
+#ifdef CONFIG_COMMON_CLK
+#define clkout_hw_to_hym8563(_hw) container_of(_hw, struct hym8563, clkout_hw)
+
+static int clkout_rates[] = {
+	32768,
+	1024,
+	32,
+	1,
+};
+
+static unsigned long hym8563_clkout_recalc_rate(struct clk_hw *hw,
+						unsigned long parent_rate)
+{
+	struct hym8563 *hym8563 = clkout_hw_to_hym8563(hw);
+	ktime_t start = ktime_get();
+	unsigned int val;
+	int ret;
+
+	hym8563_lock(hym8563, HYM8563_OP_CLKOUT);
+	ret = hym8563_reg_read(hym8563, HYM8563_CLKOUT, &val);
+	hym8563_unlock(hym8563);
+	if (hym8563_op_end(hym8563, HYM8563_OP_CLKOUT, start, ret) < 0)
+		return 0;
+
+	val &= HYM8563_CLKOUT_MASK;
+	return clkout_rates[val];
+}
+
+static long hym8563_clkout_round_rate(struct clk_hw *hw, unsigned long rate,
+				      unsigned long *prate)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(clkout_rates); i++)
+		if (clkout_rates[i] <= rate)
+			return clkout_rates[i];
+
+	return 0;
+}
+
+static int hym8563_clkout_set_rate(struct clk_hw *hw, unsigned long rate,
+				   unsigned long parent_rate)
+{
+	struct hym8563 *hym8563 = clkout_hw_to_hym8563(hw);
+	ktime_t start = ktime_get();
+	int i, ret;
+
+	for (i = 0; i < ARRAY_SIZE(clkout_rates); i++)
+		if (clkout_rates[i] == rate)
+			break;
+	if (i == ARRAY_SIZE(clkout_rates))
+		return -EINVAL;
+
+	hym8563_lock(hym8563, HYM8563_OP_CLKOUT);
+	ret = hym8563_reg_update_bits(hym8563, HYM8563_CLKOUT,
+				      HYM8563_CLKOUT_MASK, i);
+	hym8563_unlock(hym8563);
+	return hym8563_op_end(hym8563, HYM8563_OP_CLKOUT, start, ret);
+}
+
+static int hym8563_clkout_control(struct clk_hw *hw, bool enable)
+{
+	struct hym8563 *hym8563 = clkout_hw_to_hym8563(hw);
+	ktime_t start = ktime_get();
+	int ret;
+
+	hym8563_lock(hym8563, HYM8563_OP_CLKOUT);
+	ret = hym8563_reg_update_bits(hym8563, HYM8563_CLKOUT,
+				      HYM8563_CLKOUT_ENABLE,
+				      enable ? HYM8563_CLKOUT_ENABLE : 0);
+	hym8563_unlock(hym8563);
+	return hym8563_op_end(hym8563, HYM8563_OP_CLKOUT, start, ret);
+}
+
+static int hym8563_clkout_prepare(struct clk_hw *hw)
+{
+	return hym8563_clkout_control(hw, 1);
+}
+
+static void hym8563_clkout_unprepare(struct clk_hw *hw)
+{
+	hym8563_clkout_control(hw, 0);
+}
+
+static int hym8563_clkout_is_prepared(struct clk_hw *hw)
+{
+	struct hym8563 *hym8563 = clkout_hw_to_hym8563(hw);
+	ktime_t start = ktime_get();
+	unsigned int val;
+	int ret;
+
+	hym8563_lock(hym8563, HYM8563_OP_CLKOUT);
+	ret = hym8563_reg_read(hym8563, HYM8563_CLKOUT, &val);
+	hym8563_unlock(hym8563);
+	if (hym8563_op_end(hym8563, HYM8563_OP_CLKOUT, start, ret) < 0)
+		return ret;
+
+	return !!(val & HYM8563_CLKOUT_ENABLE);
+}
+
+static const struct clk_ops hym8563_clkout_ops = {
+	.prepare = hym8563_clkout_prepare,
+	.unprepare = hym8563_clkout_unprepare,
+	.is_prepared = hym8563_clkout_is_prepared,
+	.recalc_rate = hym8563_clkout_recalc_rate,
+	.round_rate = hym8563_clkout_round_rate,
+	.set_rate = hym8563_clkout_set_rate,
+};
+
+static struct clk *hym8563_clkout_register_clk(struct hym8563 *hym8563)
+{
+	struct i2c_client *client = hym8563->client;
+	struct device_node *node = client->dev.of_node;
+	struct clk *clk;
+	struct clk_init_data init;
+
+	/* CLKOUT was already switched off by hym8563_init_device() */
+	init.name = "hym8563-clkout";
+	init.ops = &hym8563_clkout_ops;
+	init.flags = CLK_IS_ROOT;
+	init.parent_names = NULL;
+	init.num_parents = 0;
+	hym8563->clkout_hw.init = &init;
+
+	/* optional override of the clockname */
+	of_property_read_string(node, "clock-output-names", &init.name);
+
+	/* register the clock */
+	clk = clk_register(&client->dev, &hym8563->clkout_hw);
+
+	if (IS_ERR(clk))
+		return clk;
+	if (node) {
+		of_clk_add_provider(node, of_clk_src_simple_get, clk);
+		return clk;
+	}
+
+	/* without DT, clk_get(&client->dev, NULL) finds it */
+	hym8563->clkout_lookup = clkdev_alloc(clk, NULL, "%s",
+					      dev_name(&client->dev));
+	if (hym8563->clkout_lookup)
+		clkdev_add(hym8563->clkout_lookup);
+	return clk;
+}
+#endif
+
+#ifdef HYM8563_NVMEM
+/*
+ * nvmem_register() takes the device's most recent regmap, so the byte
+ * gets one of its own with a single register. Its bus goes through
+ * hym8563_scratch_read()/_write(), the same RAM copy and write back that
+ * hdmi_{get,set}_data() use, so both kinds of user see one value.
+ */
+static int hym8563_nvmem_write(void *context, const void *data, size_t count)
+{
+	const u8 *buf = data;
+
+	/* register address, then the value */
+	if (count != 2 || buf[0])
+		return -EINVAL;
+	return hym8563_scratch_write(context, buf[1]);
+}
+
+static int hym8563_nvmem_read(void *context,
+			      const void *reg, size_t reg_len,
+			      void *val, size_t val_len)
+{
+	if (reg_len != 1 || *(const u8 *)reg || val_len != 1)
+		return -EINVAL;
+	*(u8 *)val = hym8563_scratch_read(context);
+	return 0;
+}
+
+static const struct regmap_bus hym8563_nvmem_bus = {
+	.write = hym8563_nvmem_write,
+	.read = hym8563_nvmem_read,
+};
+
+static const struct regmap_config hym8563_nvmem_regmap_config = {
+	.name = "scratch",
+	.reg_bits = 8,
+	.val_bits = 8,
+	.max_register = 0,
+	.cache_type = REGCACHE_NONE,
+};
+
+/* the one byte hdmi_{get,set}_data() use, for any nvmem consumer */
+static void hym8563_nvmem_register(struct hym8563 *hym8563)
+{
+	struct device *dev = &hym8563->client->dev;
+	struct nvmem_config config = {
+		.dev = dev,
+		.name = "hym8563-scratch",
+		.id = hym8563->index,
+		.owner = THIS_MODULE,
+	};
+	struct regmap *regmap;
+
+	/* must stay the last regmap of the device until nvmem_register() */
+	regmap = devm_regmap_init(dev, &hym8563_nvmem_bus, hym8563,
+				  &hym8563_nvmem_regmap_config);
+	if (IS_ERR(regmap)) {
+		dev_warn(dev, "failed to set up the nvmem regmap: %ld\n",
+			 PTR_ERR(regmap));
+		return;
+	}
+
+	hym8563->nvmem = nvmem_register(&config);
+	if (IS_ERR(hym8563->nvmem)) {
+		dev_warn(&hym8563->client->dev, "failed to register nvmem: %ld\n",
+			 PTR_ERR(hym8563->nvmem));
+		hym8563->nvmem = NULL;
+	}
+}
+#endif
+
+#if IS_ENABLED(CONFIG_PPS)
+/*
+ * Each rising edge of the 1 Hz CLKOUT is a pulse of the crystal's second.
+ * Its offset from the seconds rollover is fixed, so chrony or ntpd can
+ * number the pulses from any coarse source and calibrate the offset once.
+ */
+static irqreturn_t hym8563_pps_irq(int irq, void *data)
+{
+	struct hym8563 *hym8563 = data;
+	struct pps_event_time ts;
+
+	/* first thing, the stamp is all this source is for */
+	pps_get_ts(&ts);
+	pps_event(hym8563->pps, &ts, PPS_CAPTUREASSERT, NULL);
+	return IRQ_HANDLED;
+}
+
+static int hym8563_pps_register(struct hym8563 *hym8563)
+{
+	struct i2c_client *client = hym8563->client;
+	struct pps_source_info *info = &hym8563->pps_info;
+	struct pps_device *pps;
+	int ret;
+
+	snprintf(info->name, PPS_MAX_NAME_LEN - 1, "%s.%d",
+		 client->name, hym8563->index);
+	info->mode = PPS_CAPTUREASSERT | PPS_OFFSETASSERT | PPS_CANWAIT |
+		     PPS_TSFMT_TSPEC;
+	info->owner = THIS_MODULE;
+	info->dev = &client->dev;
+
+	pps = pps_register_source(info, PPS_CAPTUREASSERT | PPS_OFFSETASSERT);
+	if (IS_ERR_OR_NULL(pps))
+		return pps ? PTR_ERR(pps) : -ENOMEM;
+	hym8563->pps = pps;
+
+	/* a plain hard handler, nothing may run ahead of pps_get_ts() */
+	hym8563->pps_irq = gpio_to_irq(hym8563->pps_gpio);
+	ret = request_irq(hym8563->pps_irq, hym8563_pps_irq,
+			  IRQF_TRIGGER_RISING, info->name, hym8563);
+	if (ret) {
+		pps_unregister_source(pps);
+		hym8563->pps = NULL;
+		return ret;
+	}
+	return 0;
+}
+
+static void hym8563_pps_unregister(struct hym8563 *hym8563)
+{
+	if (!hym8563->pps)
+		return;
+	free_irq(hym8563->pps_irq, hym8563);
+	pps_unregister_source(hym8563->pps);
+	hym8563->pps = NULL;
+}
+#endif
+
+static int xhrtc_open(struct inode *inode, struct file *filp)
+{
+    /* the misc core hands us the miscdevice that was opened */
+    struct miscdevice *misc = filp->private_data;
+    struct hym8563 *hym8563 = container_of(misc, struct hym8563, misc);
+
+    /* misc_deregister() in remove waits for us, the instance is still here */
+    kref_get(&hym8563->kref);
+    filp->private_data = hym8563;
+    return 0;
+}
+
+static int xhrtc_release(struct inode *inode, struct file *filp)
+{
+    struct hym8563 *hym8563 = filp->private_data;
+
+    kref_put(&hym8563->kref, hym8563_free);
+    return 0;
+}
+
+static long xhrtc_alarm_batch_ioctl(struct hym8563 *hym8563, void __user *argp)
+{
+	struct xhrtc_alarm_batch batch;
+	struct xhrtc_batch_entry *ents;
+	void __user *uents;
+	long ret;
+
+	if (copy_from_user(&batch, argp, sizeof(batch)))
+		return -EFAULT;
+	if (batch.count > XHRTC_BATCH_MAX)
+		return -EINVAL;
+
+	uents = (void __user *)(uintptr_t)batch.entries;
+	ents = memdup_user(uents, batch.count * sizeof(*ents));
+	if (IS_ERR(ents))
+		return PTR_ERR(ents);
+
+	ret = hym8563_batch_validate(&batch, ents);
+	if (!ret)
+		ret = hym8563_alarm_batch(hym8563, &batch, ents);
+	if (ret >= 0 && copy_to_user(uents, ents, batch.count * sizeof(*ents)))
+		ret = -EFAULT;
+
+	kfree(ents);
+	return ret;
+}
+
+static long xhrtc_get_time_ioctl(struct hym8563 *hym8563, void __user *argp)
+{
+	struct xhrtc_time t;
+	s64 ns;
+	s32 rem;
+	int ret;
+
+	ret = hym8563_read_precise(hym8563, HYM8563_OP_IOCTL, &ns);
+	if (ret)
+		return ret;
+
+	t.tv_sec = div_s64_rem(ns, NSEC_PER_SEC, &rem);
+	t.tv_nsec = rem;
+	return copy_to_user(argp, &t, sizeof(t)) ? -EFAULT : 0;
+}
+
+static long xhrtc_do_ioctl(struct hym8563 *hym8563, unsigned int cmd,
+			   unsigned long arg)
+{
+    int err = 0;
+    struct timespec ts;
+		
+    switch (cmd) 
+    {
+    		 case XHRTC_SET_ALARM:
+	     		break;  
+	     		
+	     	case XHRTC_CANALE_ALARM:
+	     		hym8563_cancel_xh_alarm(hym8563);
+	     		return err; 
+
+		case XHRTC_ALARM_BATCH:
+			return xhrtc_alarm_batch_ioctl(hym8563, (void __user *)arg);
+
+		case XHRTC_GET_TIME:
+			return xhrtc_get_time_ioctl(hym8563, (void __user *)arg);
+
+		case XHRTC_SET_PERIODIC:
+			return hym8563_pie_set(hym8563, arg, HYM8563_OP_IOCTL);
+	     			     		 
+	    	default:
+	        pr_err("Invalid ioctl command.\n");
+	        return -ENOTTY;
+    }		  
+    
+    if (copy_from_user(&ts, (void __user *)arg, sizeof(ts)))
+			return -EFAULT;
+		if (ts.tv_nsec < 0 || ts.tv_nsec >= NSEC_PER_SEC)
+			return -EINVAL;
+
+		pr_debug("xhrtc alarm at %ld\n",ts.tv_sec);
+		    
+    switch (cmd) 
+    {
+	     	case XHRTC_SET_ALARM:
+					err = xh_rtc_set_alarm(hym8563, &ts);
+	     		break;  
+    			     		 
+	    	default:
+	        pr_err("Invalid ioctl command.\n");
+	        return -ENOTTY;
+    }
+    
+    return err;
+}
+
+static long xhrtc_compat_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+	struct hym8563 *hym8563 = filp->private_data;
+	ktime_t start = ktime_get();
+	long ret;
+
+	/* keeps remove() out while the chip is used, as hym8563_find() does */
+	down_read(&hym8563_list_sem);
+	if (hym8563->gone)
+		ret = -ENODEV;
+	else
+		ret = hym8563_op_end(hym8563, HYM8563_OP_IOCTL, start,
+				     xhrtc_do_ioctl(hym8563, cmd, arg));
+	up_read(&hym8563_list_sem);
+	return ret;
+}
+static ssize_t cache_interval_ms_show(struct device *dev,
+				      struct device_attribute *attr, char *buf)
+{
+	struct hym8563 *hym8563 = i2c_get_clientdata(to_i2c_client(dev));
+
+	return sprintf(buf, "%u\n", hym8563->cache_interval_ms);
+}
+
+static ssize_t cache_interval_ms_store(struct device *dev,
+				       struct device_attribute *attr,
+				       const char *buf, size_t count)
+{
+	struct hym8563 *hym8563 = i2c_get_clientdata(to_i2c_client(dev));
+	unsigned int val;
+	int ret;
+
+	ret = kstrtouint(buf, 0, &val);
+	if (ret)
+		return ret;
+
+	hym8563->cache_interval_ms = val;
+	hym8563_cache_invalidate(hym8563);
+	return count;
+}
+static DEVICE_ATTR_RW(cache_interval_ms);
+
+static ssize_t cache_hits_show(struct device *dev,
+			       struct device_attribute *attr, char *buf)
+{
+	struct hym8563 *hym8563 = i2c_get_clientdata(to_i2c_client(dev));
+
+	return sprintf(buf, "%lu\n", hym8563->cache_hits);
+}
+static DEVICE_ATTR_RO(cache_hits);
+
+static ssize_t cache_misses_show(struct device *dev,
+				 struct device_attribute *attr, char *buf)
+{
+	struct hym8563 *hym8563 = i2c_get_clientdata(to_i2c_client(dev));
+
+	return sprintf(buf, "%lu\n", hym8563->cache_misses);
+}
+static DEVICE_ATTR_RO(cache_misses);
+
+static ssize_t async_program_show(struct device *dev,
+				  struct device_attribute *attr, char *buf)
+{
+	struct hym8563 *hym8563 = i2c_get_clientdata(to_i2c_client(dev));
+
+	return sprintf(buf, "%d\n", hym8563->async_program);
+}
+
+static ssize_t async_program_store(struct device *dev,
+				   struct device_attribute *attr,
+				   const char *buf, size_t count)
+{
+	struct hym8563 *hym8563 = i2c_get_clientdata(to_i2c_client(dev));
+	bool val;
+	int ret;
+
+	ret = strtobool(buf, &val);
+	if (ret)
+		return ret;
+
+	mutex_lock(&hym8563->alarm_lock);
+	hym8563->async_program = val;
+	mutex_unlock(&hym8563->alarm_lock);
+	/* leaving async mode must not strand a pending update */
+	if (!val)
+		flush_work(&hym8563->rearm_work);
+	return count;
+}
+static DEVICE_ATTR_RW(async_program);
+
+static ssize_t precise_time_show(struct device *dev,
+				 struct device_attribute *attr, char *buf)
+{
+	struct hym8563 *hym8563 = i2c_get_clientdata(to_i2c_client(dev));
+
+	return sprintf(buf, "%d\n", hym8563->precise_time);
+}
+
+static ssize_t precise_time_store(struct device *dev,
+				  struct device_attribute *attr,
+				  const char *buf, size_t count)
+{
+	struct hym8563 *hym8563 = i2c_get_clientdata(to_i2c_client(dev));
+	bool val;
+	int ret;
+
+	ret = strtobool(buf, &val);
+	if (ret)
+		return ret;
+
+	hym8563->precise_time = val;
+	/* hand the snapshot back to plain samples */
+	if (!val)
+		hym8563_phase_set(hym8563, false, 0, ktime_set(0, 0));
+	return count;
+}
+static DEVICE_ATTR_RW(precise_time);
+
+static ssize_t drift_ppb_show(struct device *dev,
+			      struct device_attribute *attr, char *buf)
+{
+	struct hym8563 *hym8563 = i2c_get_clientdata(to_i2c_client(dev));
+
+	return sprintf(buf, "%d\n", hym8563->drift_ppb);
+}
 
-static unsigned long hym8563_clkout_recalc_rate(struct clk_hw *hw,
-						unsigned long parent_rate)
+static ssize_t drift_ppb_store(struct device *dev,
+			       struct device_attribute *attr,
+			       const char *buf, size_t count)
 {
-	struct hym8563 *hym8563 = clkout_hw_to_hym8563(hw);
-	struct i2c_client *client = hym8563->client;
-	u8 ret;
-	
-	hym8563_i2c_read_regs(client, HYM8563_CLKOUT, &ret, 1);
+	struct hym8563 *hym8563 = i2c_get_clientdata(to_i2c_client(dev));
+	s64 anchor;
+	s32 ppb;
+	int val;
+	int ret;
 
-	if (ret < 0)
-		return 0;
+	ret = kstrtoint(buf, 0, &val);
+	if (ret)
+		return ret;
+	if (abs(val) > HYM8563_DRIFT_MAX_PPB)
+		return -ERANGE;
 
-	ret &= HYM8563_CLKOUT_MASK;
-	return clkout_rates[ret];
+	hym8563_drift_get(hym8563, &ppb, &anchor);
+	hym8563_drift_set(hym8563, val, anchor);
+	hym8563_alarm_resync(hym8563, HYM8563_OP_OTHER);
+	return count;
 }
+static DEVICE_ATTR_RW(drift_ppb);
 
-static long hym8563_clkout_round_rate(struct clk_hw *hw, unsigned long rate,
-				      unsigned long *prate)
+static ssize_t drift_anchor_show(struct device *dev,
+				 struct device_attribute *attr, char *buf)
 {
-	int i;
+	struct hym8563 *hym8563 = i2c_get_clientdata(to_i2c_client(dev));
 
-	for (i = 0; i < ARRAY_SIZE(clkout_rates); i++)
-		if (clkout_rates[i] <= rate)
-			return clkout_rates[i];
+	s64 anchor;
+	s32 ppb;
 
-	return 0;
+	hym8563_drift_get(hym8563, &ppb, &anchor);
+	return sprintf(buf, "%lld\n", (long long)anchor);
 }
 
-static int hym8563_clkout_set_rate(struct clk_hw *hw, unsigned long rate,
-				   unsigned long parent_rate)
+static ssize_t drift_anchor_store(struct device *dev,
+				  struct device_attribute *attr,
+				  const char *buf, size_t count)
 {
-	struct hym8563 *hym8563 = clkout_hw_to_hym8563(hw);
-	struct i2c_client *client = hym8563->client;
-	u8 ret;
-	int i;
+	struct hym8563 *hym8563 = i2c_get_clientdata(to_i2c_client(dev));
+	s64 val, anchor;
+	s32 ppb;
+	int ret;
 
-	hym8563_i2c_read_regs(client, HYM8563_CLKOUT, &ret, 1);	
-	if (ret < 0)
+	ret = kstrtos64(buf, 0, &val);
+	if (ret)
 		return ret;
+	if (val < 0)
+		return -ERANGE;
 
-	for (i = 0; i < ARRAY_SIZE(clkout_rates); i++)
-		if (clkout_rates[i] == rate) {
-			ret &= ~HYM8563_CLKOUT_MASK;
-			ret |= i;
-			hym8563_i2c_set_regs(client,HYM8563_CLKOUT, &ret,1);
-			return 0;
-		}
+	hym8563_drift_get(hym8563, &ppb, &anchor);
+	hym8563_drift_set(hym8563, ppb, val);
+	hym8563_alarm_resync(hym8563, HYM8563_OP_OTHER);
+	return count;
+}
+static DEVICE_ATTR_RW(drift_anchor);
+
+static struct attribute *hym8563_attrs[] = {
+	&dev_attr_cache_interval_ms.attr,
+	&dev_attr_cache_hits.attr,
+	&dev_attr_cache_misses.attr,
+	&dev_attr_async_program.attr,
+	&dev_attr_precise_time.attr,
+	&dev_attr_drift_ppb.attr,
+	&dev_attr_drift_anchor.attr,
+	NULL,
+};
+
+static const struct attribute_group hym8563_attr_group = {
+	.attrs = hym8563_attrs,
+};
+
+#ifdef CONFIG_DEBUG_FS
+static int hym8563_regcache_show(struct seq_file *s, void *unused)
+{
+	struct hym8563 *hym8563 = s->private;
 
-	return -EINVAL;
+	seq_printf(s, "cache_reads: %lu\n", hym8563->regcache_reads);
+	seq_printf(s, "bus_reads: %lu\n", hym8563->bus_reads);
+	return 0;
 }
 
-static int hym8563_clkout_control(struct clk_hw *hw, bool enable)
+static int hym8563_regcache_open(struct inode *inode, struct file *file)
 {
-	struct hym8563 *hym8563 = clkout_hw_to_hym8563(hw);
-	struct i2c_client *client = hym8563->client;
-	u8 ret;
+	return single_open(file, hym8563_regcache_show, inode->i_private);
+}
 
-	hym8563_i2c_read_regs(client, HYM8563_CLKOUT, &ret, 1);	
-	
-	if (ret < 0)
-		return ret;
+static const struct file_operations hym8563_regcache_fops = {
+	.owner = THIS_MODULE,
+	.open = hym8563_regcache_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
 
-	if (enable)
-		ret |= HYM8563_CLKOUT_ENABLE;
-	else
-		ret &= ~HYM8563_CLKOUT_ENABLE;
-	hym8563_i2c_set_regs(client, HYM8563_CLKOUT,  &ret, 1);
+static int hym8563_alarm_show(struct seq_file *s, void *unused)
+{
+	struct hym8563 *hym8563 = s->private;
+
+	mutex_lock(&hym8563->alarm_lock);
+	seq_printf(s, "queued: %u\n", hym8563->nr_alarms +
+		   hym8563_alarm_queued(&hym8563->rtc_alarm) +
+		   hym8563_alarm_queued(&hym8563->xh_alarm));
+	seq_printf(s, "program_requests: %lu\n", hym8563->program_requests);
+	seq_printf(s, "program_commits: %lu\n", hym8563->program_commits);
+	seq_printf(s, "event_overruns: %lu\n", hym8563->event_overruns);
+	mutex_unlock(&hym8563->alarm_lock);
 	return 0;
 }
 
-static int hym8563_clkout_prepare(struct clk_hw *hw)
+static int hym8563_alarm_open(struct inode *inode, struct file *file)
 {
-	return hym8563_clkout_control(hw, 1);
+	return single_open(file, hym8563_alarm_show, inode->i_private);
 }
 
-static void hym8563_clkout_unprepare(struct clk_hw *hw)
+static const struct file_operations hym8563_alarm_fops = {
+	.owner = THIS_MODULE,
+	.open = hym8563_alarm_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static void hym8563_seq_hist(struct seq_file *s, const unsigned long *hist)
 {
-	hym8563_clkout_control(hw, 0);
+	int i;
+
+	seq_puts(s, "usecs\tcount\n");
+	for (i = 0; i < HYM8563_LATENCY_BUCKETS; i++) {
+		if (i == HYM8563_LATENCY_BUCKETS - 1)
+			seq_printf(s, ">=%lu", 1UL << (i - 1));
+		else
+			seq_printf(s, "<%lu", 1UL << i);
+		seq_printf(s, "\t%lu\n", hist[i]);
+	}
 }
 
-static int hym8563_clkout_is_prepared(struct clk_hw *hw)
+static int hym8563_irq_latency_show(struct seq_file *s, void *unused)
 {
-	struct hym8563 *hym8563 = clkout_hw_to_hym8563(hw);
-	struct i2c_client *client = hym8563->client;
-	u8 ret;
+	struct hym8563 *hym8563 = s->private;
 
-	hym8563_i2c_read_regs(client, HYM8563_CLKOUT, &ret, 1);	
-
-	if (ret < 0)
-		return ret;
+	mutex_lock(&hym8563->alarm_lock);
+	hym8563_seq_hist(s, hym8563->irq_latency);
+	mutex_unlock(&hym8563->alarm_lock);
+	return 0;
+}
 
-	return !!(ret & HYM8563_CLKOUT_ENABLE);
+static int hym8563_irq_latency_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, hym8563_irq_latency_show, inode->i_private);
 }
 
-static const struct clk_ops hym8563_clkout_ops = {
-	.prepare = hym8563_clkout_prepare,
-	.unprepare = hym8563_clkout_unprepare,
-	.is_prepared = hym8563_clkout_is_prepared,
-	.recalc_rate = hym8563_clkout_recalc_rate,
-	.round_rate = hym8563_clkout_round_rate,
-	.set_rate = hym8563_clkout_set_rate,
+static const struct file_operations hym8563_irq_latency_fops = {
+	.owner = THIS_MODULE,
+	.open = hym8563_irq_latency_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
 };
 
-static struct clk *hym8563_clkout_register_clk(struct hym8563 *hym8563)
+static int hym8563_stats_show(struct seq_file *s, void *unused)
 {
-	struct i2c_client *client = hym8563->client;
-	struct device_node *node = client->dev.of_node;
-	struct clk *clk;
-	struct clk_init_data init;
-	int ret;
-	u8 value;
-	
-	value=0;
-	
-	ret = hym8563_i2c_set_regs(client, HYM8563_CLKOUT,  &value, 1);
-	
-	if (ret < 0)
-		return ERR_PTR(ret);
-
-	init.name = "hym8563-clkout";
-	init.ops = &hym8563_clkout_ops;
-	init.flags = CLK_IS_ROOT;
-	init.parent_names = NULL;
-	init.num_parents = 0;
-	hym8563->clkout_hw.init = &init;
+	struct hym8563 *hym8563 = s->private;
+	unsigned long wake_alarm, wake_timer;
+	struct hym8563_op_stats *stats, *st;
+	int op;
 
-	/* optional override of the clockname */
-	of_property_read_string(node, "clock-output-names", &init.name);
+	/* one consistent copy, the counters move on while this prints */
+	stats = kmalloc(sizeof(hym8563->stats), GFP_KERNEL);
+	if (!stats)
+		return -ENOMEM;
+	spin_lock(&hym8563->stats_lock);
+	memcpy(stats, hym8563->stats, sizeof(hym8563->stats));
+	wake_alarm = hym8563->wake_alarm;
+	wake_timer = hym8563->wake_timer;
+	spin_unlock(&hym8563->stats_lock);
 
-	/* register the clock */
-	clk = clk_register(&client->dev, &hym8563->clkout_hw);
+	seq_puts(s, "op\tcalls\terrors\txfers\txfer_errors\tlocks\twait_avg_ns\twait_max_ns\n");
+	for (op = 0; op < HYM8563_NR_OPS; op++) {
+		st = &stats[op];
+		seq_printf(s, "%s\t%lu\t%lu\t%lu\t%lu\t%lu\t%llu\t%llu\n",
+			   hym8563_op_names[op], st->calls, st->errors,
+			   st->xfers, st->xfer_errors, st->locks,
+			   st->locks ? div64_u64(st->lock_wait_ns, st->locks) : 0ULL,
+			   (unsigned long long)st->lock_wait_max_ns);
+	}
 
-	if (!IS_ERR(clk))
-		of_clk_add_provider(node, of_clk_src_simple_get, clk);
+	for (op = 0; op < HYM8563_NR_OPS; op++) {
+		if (!stats[op].calls)
+			continue;
+		seq_printf(s, "\n%s latency\n", hym8563_op_names[op]);
+		hym8563_seq_hist(s, stats[op].latency);
+	}
+	kfree(stats);
 
-	return clk;
+	seq_printf(s, "\nwakeups\talarm %lu\ttimer %lu\n",
+		   wake_alarm, wake_timer);
+	seq_printf(s, "bus\tfailures %u\ttrips %lu\tfallback_reads %lu\n",
+		   hym8563->bus_failures, hym8563->bus_trips,
+		   hym8563->fallback_reads);
+	return 0;
 }
-#endif
-static int xhrtc_open(struct inode *inode, struct file *filp)
+
+static int hym8563_stats_open(struct inode *inode, struct file *file)
 {
-    return 0;
+	return single_open(file, hym8563_stats_show, inode->i_private);
 }
 
-static int xhrtc_release(struct inode *inode, struct file *filp)
+/* any write clears the counters, so each benchmark run starts from zero */
+static ssize_t hym8563_stats_write(struct file *file, const char __user *buf,
+				   size_t count, loff_t *ppos)
 {
-    return 0;
+	struct hym8563 *hym8563 = ((struct seq_file *)file->private_data)->private;
+
+	spin_lock(&hym8563->stats_lock);
+	memset(hym8563->stats, 0, sizeof(hym8563->stats));
+	hym8563->wake_alarm = 0;
+	hym8563->wake_timer = 0;
+	spin_unlock(&hym8563->stats_lock);
+
+	mutex_lock(&hym8563->alarm_lock);
+	memset(hym8563->irq_latency, 0, sizeof(hym8563->irq_latency));
+	mutex_unlock(&hym8563->alarm_lock);
+	return count;
 }
 
-static long xhrtc_compat_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+static const struct file_operations hym8563_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = hym8563_stats_open,
+	.read = seq_read,
+	.write = hym8563_stats_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static void hym8563_debugfs_init(struct hym8563 *hym8563)
 {
-    int err = 0;
-    struct timespec ts;
-		struct rtc_time time;
-		struct rtc_wkalrm alarm;  
-		
-    switch (cmd) 
-    {
-    		 case XHRTC_SET_ALARM:
-	     		break;  
-	     		
-	     	case XHRTC_CANALE_ALARM:
-	     		xh_rtc_cancle_alarm();
-	     		return err; 
-	     			     		 
-	    	default:
-	        pr_err("Invalid ioctl command.\n");
-	        return -ENOTTY;
-    }		  
-    
-    if (copy_from_user(&ts, (void __user *)arg, sizeof(ts)))
-			return -EFAULT;
+	hym8563->debugfs = debugfs_create_dir(dev_name(&hym8563->client->dev),
+					      hym8563_debugfs_root);
+	if (IS_ERR_OR_NULL(hym8563->debugfs))
+		return;
 
-		printk("jessica xhrtc ts.tv_sec=%d\n",ts.tv_sec);
-				
-		rtc_time_to_tm(ts.tv_sec,&time);
-		alarm.time.tm_year = time.tm_year;
-		alarm.time.tm_mon = time.tm_mon;
-		alarm.time.tm_mday = time.tm_mday;
-		alarm.time.tm_wday = time.tm_wday;
-		alarm.time.tm_hour = time.tm_hour;
-		alarm.time.tm_min = time.tm_min;
-		alarm.time.tm_sec = time.tm_sec;
-		alarm.enabled = 1;
-		    
-    switch (cmd) 
-    {
-	     	case XHRTC_SET_ALARM:
-					xh_rtc_set_alarm(&alarm);
-	     		break;  
-    			     		 
-	    	default:
-	        pr_err("Invalid ioctl command.\n");
-	        return -ENOTTY;
-    }
-    
-    return err;
+	debugfs_create_file("regcache", S_IRUGO, hym8563->debugfs, hym8563,
+			    &hym8563_regcache_fops);
+	debugfs_create_file("alarm", S_IRUGO, hym8563->debugfs, hym8563,
+			    &hym8563_alarm_fops);
+	debugfs_create_file("irq_latency", S_IRUGO, hym8563->debugfs, hym8563,
+			    &hym8563_irq_latency_fops);
+	debugfs_create_file("stats", S_IRUGO | S_IWUSR, hym8563->debugfs, hym8563,
+			    &hym8563_stats_fops);
+}
+#else
+static void hym8563_debugfs_init(struct hym8563 *hym8563)
+{
 }
+#endif
+
 static const struct rtc_class_ops hym8563_rtc_ops = {
 	.read_time	= hym8563_rtc_read_time,
 	.set_time	= hym8563_rtc_set_time,
@@ -896,24 +3958,134 @@ static const struct rtc_class_ops hym8563_rtc_ops = {
 	.proc		= hym8563_rtc_proc
 };
 
+/* returns as many whole event records as fit in @count */
+static ssize_t xhrtc_read(struct file *filp, char __user *buf, size_t count,
+			  loff_t *ppos)
+{
+	struct hym8563 *hym8563 = filp->private_data;
+	struct xhrtc_event *ev;
+	unsigned int head, tail;
+	ssize_t done = 0;
+	int ret = 0;
+
+	if (count < sizeof(*ev))
+		return -EINVAL;
+
+	if (mutex_lock_interruptible(&hym8563->event_read_lock))
+		return -ERESTARTSYS;
+
+	while (!hym8563_event_pending(hym8563)) {
+		mutex_unlock(&hym8563->event_read_lock);
+		/* events queued before remove are still handed out */
+		if (READ_ONCE(hym8563->gone))
+			return -ENODEV;
+		if (filp->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		ret = wait_event_interruptible(hym8563->event_wait,
+					       hym8563_event_pending(hym8563) ||
+					       READ_ONCE(hym8563->gone));
+		if (ret)
+			return ret;
+		if (mutex_lock_interruptible(&hym8563->event_read_lock))
+			return -ERESTARTSYS;
+	}
+
+	head = smp_load_acquire(&hym8563->event_head);
+	tail = hym8563->event_tail;
+	while (tail != head && count - done >= sizeof(*ev)) {
+		ev = &hym8563->events[tail & (XHRTC_EVENT_RING - 1)];
+		if (copy_to_user(buf + done, ev, sizeof(*ev))) {
+			ret = -EFAULT;
+			break;
+		}
+		done += sizeof(*ev);
+		tail++;
+	}
+	smp_store_release(&hym8563->event_tail, tail);
+	mutex_unlock(&hym8563->event_read_lock);
+
+	return done ? done : ret;
+}
+
+static unsigned int xhrtc_poll(struct file *filp, poll_table *wait)
+{
+	struct hym8563 *hym8563 = filp->private_data;
+	unsigned int mask = 0;
+
+	poll_wait(filp, &hym8563->event_wait, wait);
+	if (hym8563_event_pending(hym8563))
+		mask |= POLLIN | POLLRDNORM;
+	if (READ_ONCE(hym8563->gone))
+		mask |= POLLHUP | POLLERR;
+	return mask;
+}
+
+static int xhrtc_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	struct hym8563 *hym8563 = filp->private_data;
+
+	if (vma->vm_pgoff || vma->vm_end - vma->vm_start > PAGE_SIZE)
+		return -EINVAL;
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+
+	vma->vm_flags &= ~VM_MAYWRITE;
+	vma->vm_flags |= VM_DONTEXPAND | VM_DONTDUMP;
+	/* the mapping holds its own page reference past driver removal */
+	return vm_insert_page(vma, vma->vm_start, virt_to_page(hym8563->snapshot));
+}
+
 static const struct file_operations xhrtc_fops = {
     .owner = THIS_MODULE,
     .unlocked_ioctl = xhrtc_compat_ioctl,
+    .read = xhrtc_read,
+    .poll = xhrtc_poll,
+    .mmap = xhrtc_mmap,
     .open = xhrtc_open,
     .release = xhrtc_release
 };
-static struct miscdevice xhrtc_dev = {
-    .minor = MISC_DYNAMIC_MINOR,
-    .name = "xh_rtc",
-    .fops = &xhrtc_fops
-};
+
+/*
+ * Everything probe does not need for the first read_time. Alarms queued
+ * before this runs are already programmed, so the chip is brought in
+ * line with the queue rather than blindly disarmed.
+ */
+static void hym8563_late_init(struct work_struct *work)
+{
+	struct hym8563 *hym8563 = container_of(work, struct hym8563, init_work);
+	struct i2c_client *client = hym8563->client;
+
+	mutex_lock(&hym8563->alarm_lock);
+	hym8563_alarm_rearm(hym8563, HYM8563_OP_OTHER);
+	mutex_unlock(&hym8563->alarm_lock);
+
+	snprintf(hym8563->misc_name, sizeof(hym8563->misc_name), "xh_rtc%d",
+		 hym8563->index);
+	hym8563->misc.minor = MISC_DYNAMIC_MINOR;
+	hym8563->misc.name = hym8563->misc_name;
+	hym8563->misc.fops = &xhrtc_fops;
+	hym8563->misc.parent = &client->dev;
+	if (misc_register(&hym8563->misc))
+		dev_warn(&client->dev, "failed to register %s\n", hym8563->misc_name);
+	else
+		hym8563->misc_registered = true;
+
+#ifdef HYM8563_NVMEM
+	hym8563_nvmem_register(hym8563);
+#endif
+
+#if IS_ENABLED(CONFIG_PPS)
+	if (gpio_is_valid(hym8563->pps_gpio) && hym8563_pps_register(hym8563))
+		dev_warn(&client->dev, "failed to register pps source\n");
+#endif
+}
 
 static int  hym8563_probe(struct i2c_client *client, const struct i2c_device_id *id)
 {
 	int rc = 0;
-	u8 reg = 0;
+	u8 regs[HYM8563_REG_LEN];
+	ktime_t stamp;
 	struct hym8563 *hym8563;
-	struct rtc_wkalrm alarm;
 	struct rtc_device *rtc = NULL;
 	struct rtc_time tm_read, tm = {
 		.tm_wday = 6,
@@ -927,51 +4099,139 @@ static int  hym8563_probe(struct i2c_client *client, const struct i2c_device_id
 
 	struct device_node *np = client->dev.of_node;
 	unsigned long irq_flags;
+	int board_irq;
 	int result;
 	
-	if (!i2c_check_functionality(client->adapter, I2C_FUNC_I2C))
+	if (!i2c_check_functionality(client->adapter, I2C_FUNC_I2C) &&
+	    !i2c_check_functionality(client->adapter, I2C_FUNC_SMBUS_I2C_BLOCK))
 		return -ENODEV;
 		
-	hym8563 = devm_kzalloc(&client->dev,sizeof(*hym8563), GFP_KERNEL);
+	/* not devm, open /dev/xh_rtc files may hold it past remove() */
+	hym8563 = kzalloc(sizeof(*hym8563), GFP_KERNEL);
 	if (!hym8563) {
 		return -ENOMEM;
 	}
+	kref_init(&hym8563->kref);
 
-	gClient = client;	
+	/* the DT rtc alias names the chip, the others take what is left */
+	rc = np ? of_alias_get_id(np, "rtc") : -ENODEV;
+	if (rc >= 0)
+		rc = ida_simple_get(&hym8563_ida, rc, rc + 1, GFP_KERNEL);
+	if (rc < 0)
+		rc = ida_simple_get(&hym8563_ida, 0, 0, GFP_KERNEL);
+	hym8563->index = rc;
+	if (rc < 0)
+		goto exit;
+	rc = 0;
 	hym8563->client = client;
+	hym8563->smbus = !i2c_check_functionality(client->adapter, I2C_FUNC_I2C);
+	hym8563->bus_cooldown_ms = HYM8563_BUS_COOLDOWN_MS;
 	hym8563->alarm.enabled = 0;
+	board_irq = client->irq;
 	client->irq = 0;
 	mutex_init(&hym8563->mutex);
-	wake_lock_init(&hym8563->wake_lock, WAKE_LOCK_SUSPEND, "rtc_hym8563");
+	spin_lock_init(&hym8563->stats_lock);
+	hym8563->cur_op = HYM8563_OP_OTHER;
+	spin_lock_init(&hym8563->cache_lock);
+	mutex_init(&hym8563->alarm_lock);
+	timerqueue_init_head(&hym8563->alarms);
+	idr_init(&hym8563->alarm_idr);
+	hym8563_alarm_init(&hym8563->rtc_alarm, HYM8563_ALARM_RTC);
+	hym8563_alarm_init(&hym8563->xh_alarm, HYM8563_ALARM_XHRTC);
+	INIT_WORK(&hym8563->rearm_work, hym8563_rearm_work);
+	INIT_WORK(&hym8563->init_work, hym8563_late_init);
+	INIT_WORK(&hym8563->scratch_work, hym8563_scratch_work);
+	INIT_WORK(&hym8563->phase_work, hym8563_phase_work);
+	INIT_DELAYED_WORK(&hym8563->ack_work, hym8563_ack_work);
+	hym8563->snapshot = (struct xhrtc_snapshot *)get_zeroed_page(GFP_KERNEL);
+	if (!hym8563->snapshot) {
+		rc = -ENOMEM;
+		goto exit;
+	}
+	mutex_init(&hym8563->event_read_lock);
+	init_waitqueue_head(&hym8563->event_wait);
+	hym8563->async_program = async_program;
+	hym8563->precise_time = precise_time;
+	hym8563->cache_interval_ms = cache_interval_ms;
 	i2c_set_clientdata(client, hym8563);
 
-	hym8563_init_device(client);	
-	hym8563_enable_count(client, 0);	
+	hym8563->regmap = devm_regmap_init(&client->dev, &hym8563_regmap_bus,
+					   hym8563, &hym8563_regmap_config);
+	if (IS_ERR(hym8563->regmap)) {
+		rc = PTR_ERR(hym8563->regmap);
+		dev_err(&client->dev, "regmap init failed: %d\n", rc);
+		goto exit;
+	}
+
+	/* every probe decision below is taken from this one read */
+	rc = hym8563_read_snapshot(hym8563, regs, &stamp);
+	if (rc < 0) {
+		dev_err(&client->dev, "failed to read registers: %d\n", rc);
+		goto exit;
+	}
+	hym8563_recover_alarm(hym8563, regs);
+
+	hym8563->pps_gpio = of_get_named_gpio(np, "pps-gpios", 0);
+	if (hym8563->pps_gpio == -EPROBE_DEFER) {
+		rc = -EPROBE_DEFER;
+		goto exit;
+	}
+	if (gpio_is_valid(hym8563->pps_gpio)) {
+		rc = devm_gpio_request_one(&client->dev, hym8563->pps_gpio,
+					   GPIOF_IN, "hym8563-pps");
+		if (rc) {
+			dev_err(&client->dev, "failed to request pps gpio: %d\n", rc);
+			goto exit;
+		}
+	}
+
+	hym8563_init_device(client, regs);	
 	device_set_wakeup_capable(&client->dev, true);
+
+#ifdef CONFIG_COMMON_CLK
+	/*
+	 * Consumers look the clock up in their own probe, so the provider is
+	 * registered here. A PPS line takes the pin, it cannot be a clock too.
+	 */
+	if (!gpio_is_valid(hym8563->pps_gpio)) {
+		hym8563->clkout = hym8563_clkout_register_clk(hym8563);
+		if (IS_ERR(hym8563->clkout)) {
+			dev_warn(&client->dev, "failed to register clkout\n");
+			hym8563->clkout = NULL;
+		}
+	}
+#endif
+
+	hym8563_regs_to_tm(regs + RTC_SEC, &tm_read);
 	// check power down 
-	hym8563_i2c_read_regs(client,RTC_SEC,&reg,1);
-	if (reg&0x80) {
+	if (regs[RTC_SEC] & HYM8563_SEC_VL) {
 		dev_info(&client->dev, "clock/calendar information is no longer guaranteed\n");
 		hym8563_set_time(client, &tm);
-	}
-
-	hym8563_read_datetime(client, &tm_read);	//read time from hym8563
-	
-	if(((tm_read.tm_year < 70) | (tm_read.tm_year > 137 )) | (tm_read.tm_mon == -1) | (rtc_valid_tm(&tm_read) != 0)) //if the hym8563 haven't initialized
+	} else if(((tm_read.tm_year < 70) | (tm_read.tm_year > 137 )) | (tm_read.tm_mon == -1) | (rtc_valid_tm(&tm_read) != 0)) //if the hym8563 haven't initialized
 	{
 		hym8563_set_time(client, &tm);	//initialize the hym8563 
-	}	
+	} else {
+		/* hctosys can be served from the boot sample */
+		hym8563_cache_update(hym8563, regs + RTC_SEC, &tm_read, stamp);
+	}
 	
 	client->irq = of_get_named_gpio_flags(np, "irq_gpio", 0,(enum of_gpio_flags *)&irq_flags);
-	if(client->irq >= 0)
+	if (client->irq >= 0) {
+		hym8563->irq = gpio_to_irq(client->irq);
+	} else if (board_irq > 0) {
+		/* board code or a test adapter set the trigger with the irq */
+		hym8563->irq = board_irq;
+		irq_flags = 0;
+	}
+	if (hym8563->irq)
         {
-	        hym8563->irq = gpio_to_irq(client->irq);
-	        result = devm_request_threaded_irq(&client->dev, hym8563->irq, NULL, hym8563_wakeup_irq, irq_flags | IRQF_ONESHOT, client->dev.driver->name,hym8563 );
+	        result = devm_request_threaded_irq(&client->dev, hym8563->irq, hym8563_hard_irq, hym8563_wakeup_irq, irq_flags | IRQF_ONESHOT, client->dev.driver->name,hym8563 );
 	        if (result) {
 		        printk(KERN_ERR "%s:fail to request irq = %d, ret = 0x%x\n",__func__, hym8563->irq, result);
+		        hym8563->irq = 0;
+		        rc = result;
 		        goto exit;
 	        }
-	        enable_irq_wake(hym8563->irq);
 	        
         }
 		device_init_wakeup(&client->dev, 1);
@@ -985,20 +4245,35 @@ static int  hym8563_probe(struct i2c_client *client, const struct i2c_device_id
 	}
 	hym8563->rtc = rtc;
 	
-	g_hym8563 = hym8563;
-  hym8563_rtc_read_alarm(&gClient->dev,&alarm);
-  
-  misc_register(&xhrtc_dev);	 
-  
-  #ifdef CONFIG_COMMON_CLK
-	hym8563_clkout_register_clk(hym8563);
-	#endif
+	down_write(&hym8563_list_sem);
+	list_add_tail(&hym8563->node, &hym8563_list);
+	up_write(&hym8563_list_sem);
+
+	if (sysfs_create_group(&client->dev.kobj, &hym8563_attr_group))
+		dev_warn(&client->dev, "failed to create sysfs attributes\n");
+	hym8563_debugfs_init(hym8563);
+
+	/* whatever was left armed before boot is dropped there */
+	schedule_work(&hym8563->init_work);
 	
 	return 0;
 
 exit:
 	if (hym8563) {
-		wake_lock_destroy(&hym8563->wake_lock);
+#ifdef CONFIG_COMMON_CLK
+		if (hym8563->clkout_lookup)
+			clkdev_drop(hym8563->clkout_lookup);
+		if (hym8563->clkout) {
+			of_clk_del_provider(np);
+			clk_unregister(hym8563->clkout);
+		}
+#endif
+		/* the instance goes now, not when devres unwinds */
+		if (hym8563->irq > 0)
+			devm_free_irq(&client->dev, hym8563->irq, hym8563);
+		if (hym8563->index >= 0)
+			ida_simple_remove(&hym8563_ida, hym8563->index);
+		kref_put(&hym8563->kref, hym8563_free);
 	}
 	return rc;
 }
@@ -1007,38 +4282,180 @@ static int  hym8563_remove(struct i2c_client *client)
 {
 	struct hym8563 *hym8563 = i2c_get_clientdata(client);
 
-	wake_lock_destroy(&hym8563->wake_lock);
+	/* waits for exported API and ioctl calls still using this chip */
+	down_write(&hym8563_list_sem);
+	list_del(&hym8563->node);
+	hym8563->gone = true;
+	up_write(&hym8563_list_sem);
+	wake_up_interruptible(&hym8563->event_wait);
+
+	flush_work(&hym8563->init_work);
+#ifdef HYM8563_NVMEM
+	if (hym8563->nvmem)
+		nvmem_unregister(hym8563->nvmem);
+#endif
+#if IS_ENABLED(CONFIG_PPS)
+	hym8563_pps_unregister(hym8563);
+#endif
+	if (hym8563->misc_registered)
+		misc_deregister(&hym8563->misc);
+#ifdef CONFIG_COMMON_CLK
+	if (hym8563->clkout_lookup)
+		clkdev_drop(hym8563->clkout_lookup);
+	if (hym8563->clkout) {
+		of_clk_del_provider(client->dev.of_node);
+		clk_unregister(hym8563->clkout);
+	}
+#endif
+
+	/*
+	 * Both are devm and would otherwise stay until after remove; the
+	 * interrupt thread and the rtc core reach into the alarm queue.
+	 */
+	if (hym8563->irq > 0) {
+		/* a pending retry would enable the interrupt behind our back */
+		cancel_delayed_work_sync(&hym8563->ack_work);
+		devm_free_irq(&client->dev, hym8563->irq, hym8563);
+	}
+	devm_rtc_device_unregister(&client->dev, hym8563->rtc);
+
+	debugfs_remove_recursive(hym8563->debugfs);
+	sysfs_remove_group(&client->dev.kobj, &hym8563_attr_group);
+	cancel_work_sync(&hym8563->rearm_work);
+	cancel_work_sync(&hym8563->phase_work);
+	flush_work(&hym8563->scratch_work);
+	hym8563_alarm_release(hym8563);
+	/* a mapping of the time page outlives us, it must not look current */
+	hym8563_cache_drop(hym8563);
+	ida_simple_remove(&hym8563_ida, hym8563->index);
+	kref_put(&hym8563->kref, hym8563_free);
 
 	return 0;
 }
 
 
+/* a tick kept for the next second must not wake us once we are down */
+static void hym8563_tick_settle(struct hym8563 *hym8563, enum hym8563_op op)
+{
+	mutex_lock(&hym8563->alarm_lock);
+	if (!hym8563->armed && hym8563->tick_running)
+		hym8563_disarm(hym8563, op, false);
+	mutex_unlock(&hym8563->alarm_lock);
+}
+
 static void hym8563_shutdown(struct i2c_client * client)
 {
   //struct device *pdev = &client->dev;
+  struct hym8563 *hym8563 = i2c_get_clientdata(client);
   struct rtc_wkalrm alarm ;
-  struct rtc_device *rtc_dev=g_hym8563->rtc; 
-  u8 regs[4];   
+  struct rtc_device *rtc_dev=hym8563->rtc; 
     
+  flush_work(&hym8563->rearm_work);
+  flush_work(&hym8563->scratch_work);
+  cancel_delayed_work_sync(&hym8563->ack_work);
+  if (hym8563_pie_get(hym8563))
+	  hym8563_pie_set(hym8563, 0, HYM8563_OP_OTHER);
+  hym8563_tick_settle(hym8563, HYM8563_OP_OTHER);
   rtc_read_alarm(rtc_dev,&alarm);
 
-  hym8563_i2c_read_regs(client, RTC_CTL2, regs, 1);
-  regs[0] |= AIE;
-  hym8563_i2c_set_regs(client, RTC_CTL2, regs, 1);
-  hym8563_i2c_read_regs(client, RTC_CTL2, regs, 1);
-
-  regs[0] |= TIE;
-  hym8563_i2c_set_regs(client, RTC_CTL2, regs, 1);
-  hym8563_i2c_read_regs(client, RTC_CTL2, regs, 1);
+  hym8563_lock(hym8563, HYM8563_OP_OTHER);
+  hym8563->ctl2 |= AIE | TIE;
+  hym8563_write_ctl2(hym8563, false);
+  hym8563_unlock(hym8563);
   
   if(alarm.enabled == 1){
-       printk("%s this in shutdowm,the alarm.enabled =1 \n",__func__);
+       dev_dbg(&client->dev, "%s this in shutdowm,the alarm.enabled =1 \n",__func__);
 	}  
 	
 }
 
 
 
+#ifdef CONFIG_PM_SLEEP
+/*
+ * The chip must be armed for the queue head before we go down. The bus
+ * is still needed for that, and the adapter's interrupt is masked in the
+ * noirq phase, so the commit happens here.
+ */
+static int hym8563_suspend(struct device *dev)
+{
+	struct hym8563 *hym8563 = i2c_get_clientdata(to_i2c_client(dev));
+	ktime_t start = ktime_get();
+	int ret = 0;
+
+	flush_work(&hym8563->init_work);
+	flush_work(&hym8563->scratch_work);
+	cancel_work_sync(&hym8563->phase_work);
+	hym8563_cache_drop(hym8563);
+	/* ticks are not worth waking for, the queue goes back to the chip */
+	hym8563->pie_suspended_hz = hym8563_pie_get(hym8563);
+	if (hym8563->pie_suspended_hz) {
+		ret = hym8563_pie_set(hym8563, 0, HYM8563_OP_SUSPEND);
+		if (ret)
+			return hym8563_op_end(hym8563, HYM8563_OP_SUSPEND,
+					      start, ret);
+	}
+	/* INT left asserted by a failed ack could not wake us */
+	if (cancel_delayed_work_sync(&hym8563->ack_work) &&
+	    !hym8563_ack_retry(hym8563))
+		return hym8563_op_end(hym8563, HYM8563_OP_SUSPEND, start, -EBUSY);
+	/* only a deferred update is outstanding, synchronous ones are on the chip */
+	if (cancel_work_sync(&hym8563->rearm_work)) {
+		mutex_lock(&hym8563->alarm_lock);
+		ret = hym8563_alarm_rearm(hym8563, HYM8563_OP_SUSPEND);
+		mutex_unlock(&hym8563->alarm_lock);
+	}
+	hym8563_tick_settle(hym8563, HYM8563_OP_SUSPEND);
+	return hym8563_op_end(hym8563, HYM8563_OP_SUSPEND, start, ret);
+}
+
+static int hym8563_suspend_noirq(struct device *dev)
+{
+	struct hym8563 *hym8563 = i2c_get_clientdata(to_i2c_client(dev));
+
+	if (hym8563->irq > 0 && device_may_wakeup(dev))
+		hym8563->irq_wake = !enable_irq_wake(hym8563->irq);
+	if (hym8563->irq_wake) {
+		hym8563->suspend_stamp = ktime_get();
+		atomic_set(&hym8563->wake_check, 1);
+	}
+	return 0;
+}
+
+/*
+ * A wakeup from the chip has had its hard interrupt by now, the noirq
+ * phase is over; the thread counts it. Without one, something else woke
+ * us and the next interrupt is an ordinary one.
+ */
+static int hym8563_resume(struct device *dev)
+{
+	struct i2c_client *client = to_i2c_client(dev);
+	struct hym8563 *hym8563 = i2c_get_clientdata(client);
+	ktime_t start = ktime_get();
+	int ret = 0;
+
+	if (hym8563->irq_wake) {
+		disable_irq_wake(hym8563->irq);
+		hym8563->irq_wake = false;
+		if (!ktime_after(ACCESS_ONCE(hym8563->hardirq_stamp),
+				 hym8563->suspend_stamp))
+			atomic_set(&hym8563->wake_check, 0);
+	}
+
+	if (hym8563->pie_suspended_hz) {
+		ret = hym8563_pie_set(hym8563, hym8563->pie_suspended_hz,
+				      HYM8563_OP_RESUME);
+		hym8563->pie_suspended_hz = 0;
+	}
+	return hym8563_op_end(hym8563, HYM8563_OP_RESUME, start, ret);
+}
+#endif
+
+static const struct dev_pm_ops hym8563_pm_ops = {
+	SET_SYSTEM_SLEEP_PM_OPS(hym8563_suspend, hym8563_resume)
+	SET_NOIRQ_SYSTEM_SLEEP_PM_OPS(hym8563_suspend_noirq, NULL)
+};
+
 static const struct i2c_device_id hym8563_id[] = {
 	{ "hym8563", 0 },
 	{},
@@ -1056,6 +4473,14 @@ static struct i2c_driver hym8563_driver = {
 		.name	= "rtc-hym8563",
 
 		.of_match_table	= hym8563_dt_idtable,
+		.pm	= &hym8563_pm_ops,
+/*
+ * Built in, hctosys reads the first rtc device right after the initcalls
+ * and would not wait for an asynchronous probe. A module loads after it.
+ */
+#if defined(MODULE) && LINUX_VERSION_CODE >= KERNEL_VERSION(4, 2, 0)
+		.probe_type = PROBE_PREFER_ASYNCHRONOUS,
+#endif
 	},
 	.probe		= hym8563_probe,
 	.remove		= hym8563_remove,
@@ -1065,12 +4490,19 @@ static struct i2c_driver hym8563_driver = {
 
 static int __init hym8563_init(void)
 {
-	return i2c_add_driver(&hym8563_driver);
+	int ret;
+
+	hym8563_debugfs_root = debugfs_create_dir("rtc-hym8563", NULL);
+	ret = i2c_add_driver(&hym8563_driver);
+	if (ret)
+		debugfs_remove_recursive(hym8563_debugfs_root);
+	return ret;
 }
 
 static void __exit hym8563_exit(void)
 {
 	i2c_del_driver(&hym8563_driver);
+	debugfs_remove_recursive(hym8563_debugfs_root);
 }
 
 MODULE_AUTHOR("lhh lhh@rock-chips.com");
@@ -0,0 +1,551 @@
+/* tools/hym8563-bench.c - per-ioctl latency and bus cost of rtc-hym8563
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * Build: gcc -O2 -Wall -o hym8563-bench hym8563-bench.c
+ *
+ * Usage: hym8563-bench [-r /dev/rtc0] [-x /dev/xh_rtc0] [-n iterations]
+ *                      [-s stats file] [-k bus kHz] [-c baseline.json]
+ *
+ * Times each operation below over -n iterations and prints one JSON
+ * object with ops/s, p50/p99/max in us and the transfers per iteration:
+ *
+ *  RTC_RD_TIME		read the time
+ *  RTC_SET_TIME	set the time it should be, which keeps it within a second
+ *  RTC_WKALM_SET	arm the rtc alarm 10 s ahead, then disarm it
+ *  XHRTC_SET_ALARM	arm the /dev/xh_rtc alarm 10 s ahead, then cancel it
+ *  XHRTC_GET_TIME	sub-second time, after one call that finds the edge
+ *  ALARM_IRQ		arm the /dev/xh_rtc alarm, move the model past it and
+ *			wait for its event; needs rtc-hym8563-emu
+ *
+ * For ALARM_IRQ, irq_p50_us and irq_p99_us also give the time from the
+ * interrupt (the event's irq_ns) to the event being read, and its
+ * xfers_per_op is what the interrupt thread used.
+ *
+ * xfers_per_op counts what the driver charged to the operation in its
+ * debugfs stats, which -s points at (default: the first device under
+ * /sys/kernel/debug/rtc-hym8563). Reads the rtc core adds around an
+ * operation are charged to read_time and left out, so the figure does
+ * not depend on the kernel version. With the rtc-hym8563-emu model
+ * loaded, bus_xfers_per_op also gives everything that crossed the bus.
+ * -k sets the model's byte_ns to the time a byte and its ack take at
+ * that bus clock, 100 and 400 being the usual ones.
+ *
+ * RTC_SET_TIME reads the time for the drift estimate and then does one
+ * burst write of the seven time registers. Against the model, its p50
+ * less that of RTC_RD_TIME is the per-write latency of the driver's
+ * transmit path. Run it on two driver builds to compare them.
+ * Allocations per write are not measured here. Count them with the
+ * kmem:kmalloc tracepoint, filtered on the driver's call sites, around
+ * the same run.
+ *
+ * -c compares against a saved run, or hym8563-baseline-*.json here,
+ * and exits 1 if an operation costs more transfers than the baseline,
+ * or, when the baseline has latencies, if p99 is over 20% worse. A
+ * baseline for this board is this tool's output redirected to a file.
+ */
+#define _DEFAULT_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/rtc.h>
+
+/* must match rtc-hym8563.c */
+#define XHRTC_SET_ALARM		0x1f2
+#define XHRTC_CANALE_ALARM	0x1f3
+#define XHRTC_GET_TIME		0x1f5
+
+struct xhrtc_time {
+	int64_t	tv_sec;
+	int64_t	tv_nsec;
+};
+
+struct xhrtc_event {
+	int32_t		id;
+	uint32_t	source;
+	int64_t		expires_ns;
+	int64_t		irq_ns;
+};
+
+#define STATS_GLOB	"/sys/kernel/debug/rtc-hym8563/*/stats"
+#define EMU_XFERS	"/sys/kernel/debug/hym8563-emu/xfers"
+#define EMU_BYTE_NS	"/sys/module/rtc_hym8563_emu/parameters/byte_ns"
+#define EMU_ADVANCE	"/sys/kernel/debug/hym8563-emu/advance"
+/* past an alarm armed 10 s ahead, whatever the second we are in */
+#define IRQ_ADVANCE_S	12
+/* a byte is 9 clocks with its ack */
+#define BYTE_CLOCKS	9
+#define P99_TOLERANCE	1.20
+
+struct bench {
+	int		rtc_fd;
+	int		xh_fd;
+	const char	*stats;
+	int		emu;
+	/* RTC time at mono_base, for the operations that need "now" */
+	int64_t		rtc_base;
+	int64_t		mono_base;
+	/* interrupt to event latencies of the current run, see op_alarm_irq() */
+	int64_t		*irq_lat;
+	long		irq_n;
+};
+
+struct bench_op {
+	const char	*name;
+	const char	*driver_op;	/* row of the debugfs stats it is charged to */
+	int		(*run)(struct bench *b);
+	int		(*warm)(struct bench *b);
+	int		emu_only;
+};
+
+struct result {
+	double		ops_per_sec;
+	double		p50_us;
+	double		p99_us;
+	double		max_us;
+	double		xfers;		/* < 0 when not known */
+	double		bus_xfers;
+	double		irq_p50_us;	/* < 0 for operations without one */
+	double		irq_p99_us;
+};
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int64_t rtc_now(struct bench *b)
+{
+	return b->rtc_base + (now_ns() - b->mono_base) / 1000000000LL;
+}
+
+static void sec_to_rtc_time(int64_t sec, struct rtc_time *tm)
+{
+	time_t t = sec;
+	struct tm g;
+
+	gmtime_r(&t, &g);
+	memset(tm, 0, sizeof(*tm));
+	tm->tm_sec = g.tm_sec;
+	tm->tm_min = g.tm_min;
+	tm->tm_hour = g.tm_hour;
+	tm->tm_mday = g.tm_mday;
+	tm->tm_mon = g.tm_mon;
+	tm->tm_year = g.tm_year;
+	tm->tm_wday = g.tm_wday;
+	tm->tm_yday = g.tm_yday;
+}
+
+static int write_file(const char *path, const char *val)
+{
+	FILE *f = fopen(path, "w");
+	int ret;
+
+	if (!f)
+		return -1;
+	ret = fputs(val, f) < 0 ? -1 : 0;
+	if (fclose(f))
+		ret = -1;
+	return ret;
+}
+
+static int op_rd_time(struct bench *b)
+{
+	struct rtc_time tm;
+
+	return ioctl(b->rtc_fd, RTC_RD_TIME, &tm);
+}
+
+static int op_set_time(struct bench *b)
+{
+	struct rtc_time tm;
+
+	sec_to_rtc_time(rtc_now(b), &tm);
+	return ioctl(b->rtc_fd, RTC_SET_TIME, &tm);
+}
+
+static int op_wkalm_set(struct bench *b)
+{
+	struct rtc_wkalrm alrm = { .enabled = 1 };
+
+	sec_to_rtc_time(rtc_now(b) + 10, &alrm.time);
+	if (ioctl(b->rtc_fd, RTC_WKALM_SET, &alrm) < 0)
+		return -1;
+	alrm.enabled = 0;
+	return ioctl(b->rtc_fd, RTC_WKALM_SET, &alrm);
+}
+
+static int op_xh_set_alarm(struct bench *b)
+{
+	struct timespec ts = { .tv_sec = rtc_now(b) + 10 };
+
+	if (ioctl(b->xh_fd, XHRTC_SET_ALARM, &ts) < 0)
+		return -1;
+	return ioctl(b->xh_fd, XHRTC_CANALE_ALARM, 0);
+}
+
+static int op_xh_get_time(struct bench *b)
+{
+	struct xhrtc_time t;
+
+	return ioctl(b->xh_fd, XHRTC_GET_TIME, &t);
+}
+
+/* the model's clock jumps, and the RTC time with it */
+static int op_alarm_irq(struct bench *b)
+{
+	struct timespec ts = { .tv_sec = rtc_now(b) + 10 };
+	struct xhrtc_event ev;
+	char val[32];
+
+	if (ioctl(b->xh_fd, XHRTC_SET_ALARM, &ts) < 0)
+		return -1;
+	snprintf(val, sizeof(val), "%lld", IRQ_ADVANCE_S * 1000000000LL);
+	if (write_file(EMU_ADVANCE, val) < 0)
+		return -1;
+	b->rtc_base += IRQ_ADVANCE_S;
+	if (read(b->xh_fd, &ev, sizeof(ev)) != sizeof(ev))
+		return -1;
+	b->irq_lat[b->irq_n++] = now_ns() - ev.irq_ns;
+	return 0;
+}
+
+static const struct bench_op bench_ops[] = {
+	{ "RTC_RD_TIME",	"read_time",	op_rd_time,		NULL },
+	{ "RTC_SET_TIME",	"set_time",	op_set_time,		NULL },
+	{ "RTC_WKALM_SET",	"set_alarm",	op_wkalm_set,		NULL },
+	{ "XHRTC_SET_ALARM",	"ioctl",	op_xh_set_alarm,	NULL },
+	{ "XHRTC_GET_TIME",	"ioctl",	op_xh_get_time,		op_xh_get_time },
+	{ "ALARM_IRQ",		"irq",		op_alarm_irq,		NULL, 1 },
+};
+
+/* xfers charged to @op in the driver's stats, -1 if unreadable */
+static long stats_xfers(const char *path, const char *op)
+{
+	unsigned long calls, errors, xfers;
+	char line[256], name[32];
+	long ret = -1;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f)
+		return -1;
+	/* the first table ends at the first empty line */
+	if (fgets(line, sizeof(line), f)) {
+		while (fgets(line, sizeof(line), f) && line[0] != '\n') {
+			if (sscanf(line, "%31s %lu %lu %lu", name, &calls,
+				   &errors, &xfers) == 4 && !strcmp(name, op)) {
+				ret = xfers;
+				break;
+			}
+		}
+	}
+	fclose(f);
+	return ret;
+}
+
+static long emu_xfers(void)
+{
+	unsigned long xfers;
+	FILE *f;
+	int n;
+
+	f = fopen(EMU_XFERS, "r");
+	if (!f)
+		return -1;
+	n = fscanf(f, "transfers %lu", &xfers);
+	fclose(f);
+	return n == 1 ? (long)xfers : -1;
+}
+
+static int cmp_s64(const void *a, const void *b)
+{
+	int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static int bench_run(struct bench *b, const struct bench_op *op, long n,
+		     int64_t *lat, struct result *r)
+{
+	int64_t start, t, total;
+	long xfers, bus;
+	long i;
+
+	b->irq_n = 0;
+	if (op->warm && op->warm(b) < 0)
+		return -1;
+	if (b->stats)
+		write_file(b->stats, "0");
+	if (b->emu)
+		write_file(EMU_XFERS, "0");
+
+	total = now_ns();
+	for (i = 0; i < n; i++) {
+		start = now_ns();
+		if (op->run(b) < 0)
+			return -1;
+		t = now_ns();
+		lat[i] = t - start;
+	}
+	total = now_ns() - total;
+
+	xfers = b->stats ? stats_xfers(b->stats, op->driver_op) : -1;
+	bus = b->emu ? emu_xfers() : -1;
+
+	qsort(lat, n, sizeof(*lat), cmp_s64);
+	r->ops_per_sec = n * 1e9 / total;
+	r->p50_us = lat[n / 2] / 1e3;
+	r->p99_us = lat[(n * 99) / 100] / 1e3;
+	r->max_us = lat[n - 1] / 1e3;
+	r->xfers = xfers < 0 ? -1 : (double)xfers / n;
+	r->bus_xfers = bus < 0 ? -1 : (double)bus / n;
+	r->irq_p50_us = r->irq_p99_us = -1;
+	if (b->irq_n) {
+		qsort(b->irq_lat, b->irq_n, sizeof(*b->irq_lat), cmp_s64);
+		r->irq_p50_us = b->irq_lat[b->irq_n / 2] / 1e3;
+		r->irq_p99_us = b->irq_lat[(b->irq_n * 99) / 100] / 1e3;
+	}
+	return 0;
+}
+
+/* @key of the object named @op in @json, returns 0 if found */
+static int json_get(const char *json, const char *op, const char *key,
+		    double *val)
+{
+	char pat[64];
+	const char *p, *end;
+
+	snprintf(pat, sizeof(pat), "\"%s\"", op);
+	p = strstr(json, pat);
+	if (!p)
+		return -1;
+	end = strchr(p, '}');
+	snprintf(pat, sizeof(pat), "\"%s\"", key);
+	p = strstr(p, pat);
+	if (!p || (end && p > end))
+		return -1;
+	p = strchr(p + strlen(pat), ':');
+	if (!p)
+		return -1;
+	p += strspn(p + 1, " \t\n") + 1;
+	/* null, an unmeasured figure */
+	if (*p == 'n')
+		return -1;
+	*val = strtod(p, NULL);
+	return 0;
+}
+
+static char *read_all(const char *path)
+{
+	char *buf = NULL;
+	size_t len = 0, cap = 0, n;
+	FILE *f = fopen(path, "r");
+
+	if (!f)
+		return NULL;
+	do {
+		if (len + 4096 + 1 > cap) {
+			cap = cap ? cap * 2 : 8192;
+			buf = realloc(buf, cap);
+			if (!buf)
+				break;
+		}
+		n = fread(buf + len, 1, 4096, f);
+		len += n;
+	} while (n);
+	fclose(f);
+	if (buf)
+		buf[len] = '\0';
+	return buf;
+}
+
+/* returns the number of regressions against @base */
+static int compare(const char *base, const struct bench_op *op,
+		   const struct result *r)
+{
+	double want;
+	int bad = 0;
+
+	if (r->xfers >= 0 && !json_get(base, op->name, "xfers_per_op", &want) &&
+	    r->xfers > want + 0.005) {
+		fprintf(stderr, "%s: %.2f transfers per op, baseline %.2f\n",
+			op->name, r->xfers, want);
+		bad++;
+	}
+	if (!json_get(base, op->name, "p99_us", &want) &&
+	    r->p99_us > want * P99_TOLERANCE) {
+		fprintf(stderr, "%s: p99 %.1f us, baseline %.1f us\n",
+			op->name, r->p99_us, want);
+		bad++;
+	}
+	if (r->irq_p99_us >= 0 &&
+	    !json_get(base, op->name, "irq_p99_us", &want) &&
+	    r->irq_p99_us > want * P99_TOLERANCE) {
+		fprintf(stderr, "%s: interrupt p99 %.1f us, baseline %.1f us\n",
+			op->name, r->irq_p99_us, want);
+		bad++;
+	}
+	return bad;
+}
+
+static void print_num(const char *key, double val, int last)
+{
+	if (val < 0)
+		printf("\t\t\t\"%s\": null%s\n", key, last ? "" : ",");
+	else
+		printf("\t\t\t\"%s\": %.2f%s\n", key, val, last ? "" : ",");
+}
+
+int main(int argc, char **argv)
+{
+	const char *rtc_path = "/dev/rtc0", *xh_path = "/dev/xh_rtc0";
+	const char *stats = NULL, *base_path = NULL;
+	struct bench b = { 0 };
+	struct result r;
+	struct rtc_time tm;
+	char *base = NULL;
+	long n = 1000, khz = 0;
+	int64_t *lat;
+	glob_t g;
+	char val[32];
+	size_t i;
+	int opt, bad = 0, done = 0;
+
+	while ((opt = getopt(argc, argv, "r:x:n:s:k:c:")) != -1) {
+		switch (opt) {
+		case 'r':
+			rtc_path = optarg;
+			break;
+		case 'x':
+			xh_path = optarg;
+			break;
+		case 'n':
+			n = atol(optarg);
+			break;
+		case 's':
+			stats = optarg;
+			break;
+		case 'k':
+			khz = atol(optarg);
+			break;
+		case 'c':
+			base_path = optarg;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-r rtc] [-x xh_rtc] [-n iterations] [-s stats] [-k bus kHz] [-c baseline]\n",
+				argv[0]);
+			return 2;
+		}
+	}
+	if (n <= 0 || khz < 0) {
+		fprintf(stderr, "iterations must be positive\n");
+		return 2;
+	}
+
+	b.rtc_fd = open(rtc_path, O_RDONLY);
+	if (b.rtc_fd < 0) {
+		fprintf(stderr, "%s: %s\n", rtc_path, strerror(errno));
+		return 1;
+	}
+	b.xh_fd = open(xh_path, O_RDWR);
+	if (b.xh_fd < 0) {
+		fprintf(stderr, "%s: %s\n", xh_path, strerror(errno));
+		return 1;
+	}
+
+	if (!stats && !glob(STATS_GLOB, 0, NULL, &g)) {
+		stats = strdup(g.gl_pathv[0]);
+		globfree(&g);
+	}
+	if (stats && stats_xfers(stats, "read_time") < 0) {
+		fprintf(stderr, "%s: no driver stats, transfers not counted\n",
+			stats);
+		stats = NULL;
+	}
+	b.stats = stats;
+	b.emu = emu_xfers() >= 0;
+
+	if (khz) {
+		snprintf(val, sizeof(val), "%ld", BYTE_CLOCKS * 1000000L / khz);
+		if (write_file(EMU_BYTE_NS, val)) {
+			fprintf(stderr, "%s: %s\n", EMU_BYTE_NS, strerror(errno));
+			return 1;
+		}
+	}
+
+	if (base_path) {
+		base = read_all(base_path);
+		if (!base) {
+			fprintf(stderr, "%s: %s\n", base_path, strerror(errno));
+			return 1;
+		}
+	}
+
+	if (ioctl(b.rtc_fd, RTC_RD_TIME, &tm) < 0) {
+		fprintf(stderr, "RTC_RD_TIME: %s\n", strerror(errno));
+		return 1;
+	}
+	b.mono_base = now_ns();
+	b.rtc_base = timegm(&(struct tm){
+		.tm_sec = tm.tm_sec, .tm_min = tm.tm_min,
+		.tm_hour = tm.tm_hour, .tm_mday = tm.tm_mday,
+		.tm_mon = tm.tm_mon, .tm_year = tm.tm_year,
+	});
+
+	lat = calloc(n, sizeof(*lat));
+	b.irq_lat = calloc(n, sizeof(*b.irq_lat));
+	if (!lat || !b.irq_lat)
+		return 1;
+
+	printf("{\n");
+	if (khz)
+		printf("\t\"bus_khz\": %ld,\n", khz);
+	else
+		printf("\t\"bus_khz\": null,\n");
+	printf("\t\"iterations\": %ld,\n", n);
+	printf("\t\"ops\": {\n");
+	for (i = 0; i < sizeof(bench_ops) / sizeof(bench_ops[0]); i++) {
+		const struct bench_op *op = &bench_ops[i];
+
+		if (op->emu_only && !b.emu)
+			continue;
+		if (bench_run(&b, op, n, lat, &r)) {
+			fprintf(stderr, "%s: %s\n", op->name, strerror(errno));
+			return 1;
+		}
+		/* the separator goes first, a skipped operation may be the last */
+		printf("%s\t\t\"%s\": {\n", done++ ? ",\n" : "", op->name);
+		print_num("ops_per_sec", r.ops_per_sec, 0);
+		print_num("p50_us", r.p50_us, 0);
+		print_num("p99_us", r.p99_us, 0);
+		print_num("max_us", r.max_us, 0);
+		print_num("xfers_per_op", r.xfers, 0);
+		print_num("bus_xfers_per_op", r.bus_xfers, 0);
+		print_num("irq_p50_us", r.irq_p50_us, 0);
+		print_num("irq_p99_us", r.irq_p99_us, 1);
+		printf("\t\t}");
+		if (base)
+			bad += compare(base, op, &r);
+	}
+	printf("\n\t}\n}\n");
+
+	free(b.irq_lat);
+	free(lat);
+	free(base);
+	close(b.xh_fd);
+	close(b.rtc_fd);
+	return bad ? 1 : 0;
+}
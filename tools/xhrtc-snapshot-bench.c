@@ -0,0 +1,142 @@
+/* tools/xhrtc-snapshot-bench.c - time page reads against RTC_RD_TIME
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * Build: gcc -O2 -Wall -o xhrtc-snapshot-bench xhrtc-snapshot-bench.c
+ *
+ * Usage: xhrtc-snapshot-bench [-x /dev/xh_rtc0] [-r /dev/rtc0]
+ *                             [-n snapshot reads] [-m ioctl reads]
+ *
+ * Reports the cost per read of both paths and how far the snapshot is
+ * from the chip, which should stay below a second (a few ms with
+ * XHRTC_SNAPSHOT_EDGE set).
+ */
+#define _DEFAULT_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/rtc.h>
+
+#include "xhrtc_snapshot.h"
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * XHRTC_NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static int64_t rtc_time_to_sec(const struct rtc_time *tm)
+{
+	struct tm t = {
+		.tm_sec = tm->tm_sec,
+		.tm_min = tm->tm_min,
+		.tm_hour = tm->tm_hour,
+		.tm_mday = tm->tm_mday,
+		.tm_mon = tm->tm_mon,
+		.tm_year = tm->tm_year,
+	};
+
+	return timegm(&t);
+}
+
+int main(int argc, char **argv)
+{
+	const char *xh_path = "/dev/xh_rtc0", *rtc_path = "/dev/rtc0";
+	const struct xhrtc_snapshot *snap;
+	long snap_reads = 1000000, ioctl_reads = 200, i;
+	struct timespec ts;
+	struct rtc_time tm;
+	int64_t start, snap_ns, ioctl_ns, chip;
+	uint32_t flags;
+	int fd, opt, ret;
+
+	while ((opt = getopt(argc, argv, "x:r:n:m:")) != -1) {
+		switch (opt) {
+		case 'x':
+			xh_path = optarg;
+			break;
+		case 'r':
+			rtc_path = optarg;
+			break;
+		case 'n':
+			snap_reads = atol(optarg);
+			break;
+		case 'm':
+			ioctl_reads = atol(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-x xh_rtc] [-r rtc] [-n snapshot reads] [-m ioctl reads]\n",
+				argv[0]);
+			return 2;
+		}
+	}
+	if (snap_reads <= 0 || ioctl_reads <= 0) {
+		fprintf(stderr, "read counts must be positive\n");
+		return 2;
+	}
+
+	snap = xhrtc_snapshot_map(xh_path);
+	if (!snap) {
+		fprintf(stderr, "%s: %s\n", xh_path, strerror(errno));
+		return 1;
+	}
+	fd = open(rtc_path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "%s: %s\n", rtc_path, strerror(errno));
+		return 1;
+	}
+
+	/* a read_time fills the page if nothing has since probe or resume */
+	if (ioctl(fd, RTC_RD_TIME, &tm) < 0) {
+		fprintf(stderr, "RTC_RD_TIME: %s\n", strerror(errno));
+		return 1;
+	}
+
+	start = now_ns();
+	for (i = 0; i < ioctl_reads; i++) {
+		if (ioctl(fd, RTC_RD_TIME, &tm) < 0) {
+			fprintf(stderr, "RTC_RD_TIME: %s\n", strerror(errno));
+			return 1;
+		}
+	}
+	ioctl_ns = now_ns() - start;
+
+	start = now_ns();
+	for (i = 0; i < snap_reads; i++) {
+		ret = xhrtc_snapshot_read(snap, &ts, &flags);
+		if (ret) {
+			fprintf(stderr, "snapshot not valid\n");
+			return 1;
+		}
+	}
+	snap_ns = now_ns() - start;
+
+	/* whole seconds only, so compare right after the chip's reading */
+	ioctl(fd, RTC_RD_TIME, &tm);
+	xhrtc_snapshot_read(snap, &ts, &flags);
+	chip = rtc_time_to_sec(&tm);
+
+	printf("RTC_RD_TIME\t%ld reads\t%.1f ns/read\n", ioctl_reads,
+	       (double)ioctl_ns / ioctl_reads);
+	printf("snapshot\t%ld reads\t%.1f ns/read\t%s\n", snap_reads,
+	       (double)snap_ns / snap_reads,
+	       flags & XHRTC_SNAPSHOT_EDGE ? "edge" : "sample");
+	printf("speedup\t%.0fx\n", ((double)ioctl_ns / ioctl_reads) /
+	       ((double)snap_ns / snap_reads));
+	printf("snapshot - chip\t%+.3f ms\n",
+	       (double)(ts.tv_sec * XHRTC_NSEC_PER_SEC + ts.tv_nsec -
+			chip * XHRTC_NSEC_PER_SEC) / 1000000);
+
+	close(fd);
+	xhrtc_snapshot_unmap(snap);
+	return 0;
+}
@@ -0,0 +1,113 @@
+/* tools/xhrtc_snapshot.h - userspace reader for the /dev/xh_rtc time page
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * Header only. Map the page once with xhrtc_snapshot_map(), then
+ * xhrtc_snapshot_read() returns the RTC time without entering the kernel
+ * beyond what clock_gettime(CLOCK_MONOTONIC) costs, which is usually
+ * nothing on a vDSO system.
+ */
+#ifndef XHRTC_SNAPSHOT_H
+#define XHRTC_SNAPSHOT_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+/* must match struct xhrtc_snapshot in rtc-hym8563.c */
+#define XHRTC_SNAPSHOT_VALID	(1u << 0)
+#define XHRTC_SNAPSHOT_EDGE	(1u << 1)
+
+struct xhrtc_snapshot {
+	uint32_t	seq;
+	uint32_t	flags;
+	int64_t		rtc_sec;
+	int64_t		mono_ns;
+	int32_t		drift_ppb;
+	uint32_t	reserved;
+};
+
+#define XHRTC_NSEC_PER_SEC	1000000000LL
+
+/* returns the mapped page, or NULL with errno set */
+static inline const struct xhrtc_snapshot *xhrtc_snapshot_map(const char *path)
+{
+	void *page;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+	page = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, fd, 0);
+	/* the mapping keeps the page, the file is not needed any more */
+	close(fd);
+	return page == MAP_FAILED ? NULL : page;
+}
+
+static inline void xhrtc_snapshot_unmap(const struct xhrtc_snapshot *snap)
+{
+	munmap((void *)snap, sysconf(_SC_PAGESIZE));
+}
+
+/*
+ * Copy the page under its sequence count: seq is odd while the driver
+ * writes, and a copy is only good if seq was even and unchanged around it.
+ */
+static inline void xhrtc_snapshot_copy(const struct xhrtc_snapshot *snap,
+				       struct xhrtc_snapshot *out)
+{
+	uint32_t seq;
+
+	for (;;) {
+		seq = __atomic_load_n(&snap->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+			continue;
+		out->flags = __atomic_load_n(&snap->flags, __ATOMIC_RELAXED);
+		out->rtc_sec = __atomic_load_n(&snap->rtc_sec, __ATOMIC_RELAXED);
+		out->mono_ns = __atomic_load_n(&snap->mono_ns, __ATOMIC_RELAXED);
+		out->drift_ppb = __atomic_load_n(&snap->drift_ppb, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&snap->seq, __ATOMIC_RELAXED) == seq)
+			break;
+	}
+	out->seq = seq;
+}
+
+/*
+ * Current chip time in @ts. The crystal runs drift_ppb fast against
+ * CLOCK_MONOTONIC, so the time since the sample is scaled by it, in ms
+ * as the driver does to keep long spans within 64 bits. Returns 0, or
+ * -EAGAIN while the page holds no sample: before the first read after
+ * probe and from suspend until the first read after resume. @flags, if
+ * given, receives the page flags; without XHRTC_SNAPSHOT_EDGE the result
+ * may trail the chip by up to a second.
+ */
+static inline int xhrtc_snapshot_read(const struct xhrtc_snapshot *snap,
+				      struct timespec *ts, uint32_t *flags)
+{
+	struct xhrtc_snapshot s;
+	struct timespec mono;
+	int64_t elapsed, ns;
+
+	xhrtc_snapshot_copy(snap, &s);
+	if (flags)
+		*flags = s.flags;
+	if (!(s.flags & XHRTC_SNAPSHOT_VALID))
+		return -EAGAIN;
+
+	clock_gettime(CLOCK_MONOTONIC, &mono);
+	elapsed = mono.tv_sec * XHRTC_NSEC_PER_SEC + mono.tv_nsec - s.mono_ns;
+	elapsed += elapsed / 1000000 * s.drift_ppb / 1000;
+
+	ns = s.rtc_sec * XHRTC_NSEC_PER_SEC + elapsed;
+	ts->tv_sec = ns / XHRTC_NSEC_PER_SEC;
+	ts->tv_nsec = ns % XHRTC_NSEC_PER_SEC;
+	return 0;
+}
+
+#endif